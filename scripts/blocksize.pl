@@ -0,0 +1,61 @@
+#!/usr/bin/env perl
+#
+# Copyright (c) 2012-2014 Darren Kulp
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to
+# deal in the Software without restriction, including without limitation the
+# rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+#
+
+# Checks that the decoder's output, characters and the sample offsets at which
+# they complete, does not depend on how its input is chunked : the same file
+# is decoded in blocks of 1 to 65536 frames, both from a mapped file and from
+# a pipe, and every run must match the first.
+
+use strict;
+
+my $fname = "blocksize.wav";
+my $rate = 8000;
+my $genopts = "-C 1 -G .5 -I 1000 -L 120000";
+
+my @sizes = (1 .. 16, map { (2 ** $_ - 1, 2 ** $_, 2 ** $_ + 1) } 5 .. 16);
+
+my @bytes = map { int rand 128 } 1 .. 200;
+system("./gen -s $rate -o $fname $genopts @bytes") == 0 or die "gen failed";
+
+my @reference = qx(./suite -t 1 $fname 2> /dev/null);
+die "No characters decoded" unless @reference;
+
+my $failures = 0;
+for my $size (@sizes) {
+    for my $source ("$fname", "- < $fname") {
+        my @lines = qx(./suite -t -B $size 1 $source 2> /dev/null);
+        next if join("", @lines) eq join("", @reference);
+
+        my ($i) = grep { ($lines[$_] // "") ne ($reference[$_] // "") } 0 .. $#reference;
+        $i //= scalar @reference;
+        chomp(my $want = $reference[$i] // "(end)");
+        chomp(my $got = $lines[$i] // "(end)");
+        warn "Block size $size from `$source' differs at line $i : `$got' vs `$want'\n";
+        $failures++;
+    }
+}
+
+unlink $fname;
+die "$failures runs differed" if $failures;
+printf "%d block sizes gave identical output (%d characters)\n", scalar @sizes, scalar @reference;
+
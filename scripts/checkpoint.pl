@@ -0,0 +1,103 @@
+#!/usr/bin/env perl
+#
+# Copyright (c) 2012-2014 Darren Kulp
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to
+# deal in the Software without restriction, including without limitation the
+# rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+#
+
+# Checks that a decoder restored from a checkpoint carries on exactly where
+# the saved one left off : the same file is decoded while the decoder is
+# rebuilt from a checkpoint every few frames, and in pieces by separate runs
+# that hand a checkpoint on to each other, and every run must match a plain
+# decode, character offsets included. A checkpoint must also be refused by a
+# decoder with other settings.
+
+use strict;
+
+my $fname = "checkpoint.raw";
+my $saved = "checkpoint.state";
+my $rate = 8000;
+my $genopts = "-R -C 1 -G .5 -I 1000 -L 120000";
+
+my @intervals = (1, 13, 333, 1000, 4097);
+my @splits = (1, 4321, 55555, 119999);
+
+my @bytes = map { int rand 128 } 1 .. 200;
+system("./gen -s $rate -o $fname $genopts @bytes") == 0 or die "gen failed";
+
+my $suite = "./suite -t -r $rate";
+my $reference = join "", qx($suite 1 $fname 2> /dev/null);
+die "No characters decoded" unless $reference;
+
+my $failures = 0;
+sub compare
+{
+    my ($what, $output) = @_;
+    return if $output eq $reference;
+    warn "$what differs from a plain decode\n";
+    $failures++;
+}
+
+for my $every (@intervals) {
+    for my $source ("$fname", "- < $fname") {
+        compare("Rebuilding every $every frames from `$source'",
+                join "", qx($suite -R $every 1 $source 2> /dev/null));
+    }
+}
+
+# runs of 16-bit mono, handing a checkpoint on from one to the next
+open my $in, "<", $fname or die "$fname : $!";
+binmode $in;
+my $raw = do { local $/; <$in> };
+close $in;
+
+my @pieces;
+my $at = 0;
+for my $end (@splits, length($raw) / 2) {
+    my $piece = "checkpoint." . scalar(@pieces) . ".raw";
+    open my $out, ">", $piece or die "$piece : $!";
+    binmode $out;
+    print $out substr $raw, $at * 2, ($end - $at) * 2;
+    close $out;
+    push @pieces, $piece;
+    $at = $end;
+}
+
+unlink $saved;
+my $output = "";
+for my $i (0 .. $#pieces) {
+    my $opts = ($i ? "-L $saved " : "") . ($i < $#pieces ? "-S $saved" : "");
+    $output .= join "", qx($suite $opts 1 $pieces[$i] 2> /dev/null);
+    die "Decoding piece $i failed" if $?;
+}
+compare("Decoding in " . scalar(@pieces) . " pieces", $output);
+
+# a checkpoint from channel 1 at Bell 103 settings
+system("./suite -r $rate -S $saved 1 $pieces[0] > /dev/null 2>&1") == 0 or die "Saving failed";
+for my $other ("-r $rate 0", "-r $rate -p v21 1", "-r 11025 1") {
+    my $err = qx(./suite -L $saved $other $pieces[1] 2>&1 > /dev/null);
+    next if $? && $err =~ /Invalid argument/;
+    warn "A decoder with `$other' accepted the checkpoint\n";
+    $failures++;
+}
+
+unlink $fname, $saved, @pieces;
+die "$failures runs failed" if $failures;
+printf "Checkpoints held at %d intervals and across %d runs (%d characters)\n",
+        scalar @intervals, scalar @pieces, scalar(() = $reference =~ /\n/g);
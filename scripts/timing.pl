@@ -0,0 +1,70 @@
+#!/usr/bin/env perl
+#
+# Copyright (c) 2012-2014 Darren Kulp
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to
+# deal in the Software without restriction, including without limitation the
+# rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+#
+
+# Decodes characters sent back to back, with nothing between one character's
+# STOP bits and the next one's START bit, for each modem profile, on each of
+# its channels and at several sample rates : every character must come back,
+# in order and with good parity. gen frames characters as suite expects them,
+# 7 data bits with even parity, and the file is padded so that the last
+# character's STOP bits are followed by enough audio to be seen. At rates that
+# do not divide evenly by the baud rate, bits are not a whole number of
+# samples long, so any rounding that builds up over a character, or a wait
+# for the next START edge that runs past it, shows.
+
+use strict;
+
+my $fname = "timing.wav";
+my $count = 100;
+my @rates = (8000, 11025, 22050, 44100, 48000);
+my %profiles = (bell103 => [0, 1], v21 => [0, 1], bell202 => [0], v23 => [0]);
+
+my $failures = 0;
+for my $profile (sort keys %profiles) {
+    for my $rate (@rates) {
+        for my $channel (@{ $profiles{$profile} }) {
+            my @bytes = map { int rand 128 } 1 .. $count;
+            my $genopts = "-p $profile -C $channel -G .5 -D 7 -P 1 -I 1000 -L " . ($rate * 5);
+            system("./gen -s $rate -o $fname $genopts @bytes") == 0 or die "gen failed";
+
+            # a character can be a newline, so the output is not split into
+            # lines ; the silence after the text may decode as more
+            my $output = qx(./suite -p $profile $channel $fname 2> /dev/null);
+            my @got;
+            while ($output =~ /\((\d+)\)( \(PARITY FAILED\))?\n/g) {
+                push @got, $2 ? -1 : $1;
+            }
+            splice @got, $count if @got > $count;
+            next if "@got" eq "@bytes";
+
+            my ($i) = grep { ($got[$_] // -1) != $bytes[$_] } 0 .. $#bytes;
+            $i //= scalar @bytes;
+            warn sprintf "%s at %d Hz on channel %d : %d of %d characters, first wrong at %d\n",
+                    $profile, $rate, $channel, scalar @got, scalar @bytes, $i;
+            $failures++;
+        }
+    }
+}
+
+unlink $fname;
+die "$failures runs failed" if $failures;
+print "Back-to-back characters decoded for every profile at every rate\n";
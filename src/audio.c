@@ -20,8 +20,44 @@
  * IN THE SOFTWARE.
  */
 
+#include "audio.h"
+
+#include <errno.h>
+#include <string.h>
+
 const double bell103_freqs[2][2] = {
     { 1070., 1270. },
     { 2025., 2225. },
 };
 
+
+static const struct fsk_profile_info profiles[FSK_PROFILE_max] = {
+    [FSK_PROFILE_BELL103] = { "bell103",  300, 2, { { 1070., 1270. }, { 2025., 2225. } } },
+    [FSK_PROFILE_V21]     = { "v21"    ,  300, 2, { { 1180.,  980. }, { 1850., 1650. } } },
+    [FSK_PROFILE_BELL202] = { "bell202", 1200, 1, { { 2200., 1200. }, { 2200., 1200. } } },
+    [FSK_PROFILE_V23]     = { "v23"    , 1200, 1, { { 2100., 1300. }, { 2100., 1300. } } },
+};
+
+const struct fsk_profile_info *fsk_profile_info(enum fsk_profile profile)
+{
+    return (unsigned)profile < FSK_PROFILE_max ? &profiles[profile] : NULL;
+}
+
+int fsk_profile_parse(const char *name, enum fsk_profile *profile)
+{
+    for (int p = 0; p < FSK_PROFILE_max; p++) {
+        if (!strcmp(name, profiles[p].name)) {
+            *profile = p;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+void audio_set_profile(struct audio_state *as, enum fsk_profile profile)
+{
+    as->baud_rate = profiles[profile].baud_rate;
+    as->freqs     = profiles[profile].freqs;
+}
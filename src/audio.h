@@ -23,12 +23,15 @@
 #ifndef AUDIO_H_
 #define AUDIO_H_
 
+#include "tynsel_api.h"
+#include "filters.h"
+
 #include <stddef.h>
 
 struct audio_state {
     unsigned sample_rate;
     double sample_offset;
-    const unsigned baud_rate;
+    unsigned baud_rate;
 
     int start_bits,
         data_bits,
@@ -36,9 +39,38 @@ struct audio_state {
         stop_bits;
 
     const double (*freqs)[2];
+
+    // how decoders made with these settings run their filters
+    enum filter_kernel filter_kernel;
+};
+
+TYNSEL_API extern const double bell103_freqs[2][2];
+
+// The modems whose signalling is known : each fixes a baud rate and the
+// frequencies of SPACE and MARK on each channel. Channel 0 is the originating
+// (or, for V.21, the lower) one. The one-way modems carry the same tones on
+// both channels.
+enum fsk_profile {
+    FSK_PROFILE_BELL103,    // 300 baud, full duplex
+    FSK_PROFILE_V21,        // 300 baud, full duplex
+    FSK_PROFILE_BELL202,    // 1200 baud, one way
+    FSK_PROFILE_V23,        // 1200 baud (mode 2), one way
+
+    FSK_PROFILE_max
+};
+
+struct fsk_profile_info {
+    const char *name;
+    unsigned baud_rate;
+    int channels;           // 2 if full duplex, else 1
+    double freqs[2][2];     // [channel][SPACE, MARK]
 };
 
-extern const double bell103_freqs[2][2];
+TYNSEL_API const struct fsk_profile_info *fsk_profile_info(enum fsk_profile profile);
+// names are "bell103", "v21", "bell202" and "v23"
+TYNSEL_API int fsk_profile_parse(const char *name, enum fsk_profile *profile);
+// sets the baud rate and frequencies of `as' to those of `profile'
+TYNSEL_API void audio_set_profile(struct audio_state *as, enum fsk_profile profile);
 
 #define SAMPLES_PER_BIT(a) ((double)(a)->sample_rate / (a)->baud_rate)
 
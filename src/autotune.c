@@ -0,0 +1,285 @@
+#define _XOPEN_SOURCE 600
+
+#include "autotune.h"
+#include "tynsel.h"
+#include "filedecode.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUTOTUNE_CACHE_VERSION 1
+
+// length of the synthetic signal, and the best of how many runs counts
+#define AUTOTUNE_SECONDS 5
+#define AUTOTUNE_RUNS    3
+
+static const size_t feeds[] = { 64, 256, 1024, 4096 };
+static const enum filter_kernel kernels[] = {
+    FILTER_KERNEL_RING, FILTER_KERNEL_LINEAR, FILTER_KERNEL_SPLIT,
+};
+
+static const char sample_text[] =
+    "The quick brown fox jumps over the lazy dog. 0123456789 !\"#$%&'()*+,-./";
+
+struct decoded {
+    size_t count, cap;
+    int (*chars)[2];
+};
+
+static int collect(void *userdata, int status, int data)
+{
+    struct decoded *d = userdata;
+    if (d->count < d->cap) {
+        d->chars[d->count][0] = status;
+        d->chars[d->count][1] = data;
+    }
+    d->count++;
+
+    return 0;
+}
+
+static void cpu_model(size_t len, char model[len])
+{
+    snprintf(model, len, "unknown");
+
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (!f)
+        return;
+
+    char line[256];
+    while (fgets(line, sizeof line, f)) {
+        char *colon = strchr(line, ':');
+        if (colon && !strncmp(line, "model name", strlen("model name"))) {
+            char *p = colon + 1;
+            while (*p == ' ')
+                p++;
+            p[strcspn(p, "\n")] = '\0';
+            snprintf(model, len, "%s", p);
+            break;
+        }
+    }
+
+    fclose(f);
+}
+
+// everything the timings depend on, as one line of text
+static void cache_key(size_t len, char key[len], const struct audio_state *as, int channel)
+{
+    const double (*freqs)[2] = as->freqs ? as->freqs : bell103_freqs;
+    char model[128];
+    cpu_model(sizeof model, model);
+    snprintf(key, len, "%s|tynsel %d|rate %u baud %u bits %d/%d/%d/%d channel %d freqs %g/%g/%g/%g",
+            model, tynsel_version(), as->sample_rate, as->baud_rate,
+            as->start_bits, as->data_bits, as->parity_bits, as->stop_bits,
+            channel, freqs[0][0], freqs[0][1], freqs[1][0], freqs[1][1]);
+}
+
+static int cache_lookup(const char *cachefile, const char *key, struct autotune_choice *c)
+{
+    FILE *f = fopen(cachefile, "r");
+    if (!f)
+        return -1;
+
+    int version, found = 0;
+    char line[512];
+    if (fscanf(f, "# tynsel autotune %d\n", &version) == 1 && version == AUTOTUNE_CACHE_VERSION) {
+        while (!found && fgets(line, sizeof line, f)) {
+            line[strcspn(line, "\n")] = '\0';
+            char name[32];
+            size_t feed;
+            int at;
+            if (sscanf(line, "%31s %zu %n", name, &feed, &at) == 2 && !strcmp(line + at, key)
+                    && !filter_kernel_parse(name, &c->kernel) && feed > 0) {
+                c->feed = feed;
+                found = 1;
+            }
+        }
+    }
+
+    fclose(f);
+    return found ? 0 : -1;
+}
+
+// rewrites the cache with `key' mapped to `c', keeping the entries for other
+// hosts and settings ; the new file replaces the old in one step
+static int cache_store(const char *cachefile, const char *key, const struct autotune_choice *c)
+{
+    char tmpname[strlen(cachefile) + 32];
+    snprintf(tmpname, sizeof tmpname, "%s.tmp.%ld", cachefile, (long)getpid());
+    FILE *out = fopen(tmpname, "w");
+    if (!out)
+        return -1;
+
+    fprintf(out, "# tynsel autotune %d\n", AUTOTUNE_CACHE_VERSION);
+
+    FILE *in = fopen(cachefile, "r");
+    int version;
+    if (in && fscanf(in, "# tynsel autotune %d\n", &version) == 1 && version == AUTOTUNE_CACHE_VERSION) {
+        char line[512];
+        while (fgets(line, sizeof line, in)) {
+            int at = 0;
+            sscanf(line, "%*s %*u %n", &at);
+            line[strcspn(line, "\n")] = '\0';
+            if (at && strcmp(line + at, key))
+                fprintf(out, "%s\n", line);
+        }
+    }
+    if (in)
+        fclose(in);
+
+    fprintf(out, "%s %zu %s\n", filter_kernel_name(c->kernel), c->feed, key);
+
+    if (fclose(out) || rename(tmpname, cachefile)) {
+        int e = errno;
+        unlink(tmpname);
+        errno = e;
+        return -1;
+    }
+
+    return 0;
+}
+
+double *autotune_signal(const struct audio_state *as, int channel, size_t frames)
+{
+    double *samples = malloc(frames * sizeof *samples);
+    if (!samples)
+        return NULL;
+
+    const struct encode_state tmpl = {
+        .audio   = *as,
+        .channel = channel,
+        .gain    = 0.5,
+    };
+    struct encode_stream *e;
+    if (encode_stream_init(&e, &tmpl, sizeof sample_text)) {
+        free(samples);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < frames; i += FILEDECODE_BLOCK) {
+        if (!encode_stream_busy(e))
+            encode_stream_queue(e, sizeof sample_text - 1, (const unsigned char *)sample_text);
+        size_t n = frames - i < FILEDECODE_BLOCK ? frames - i : FILEDECODE_BLOCK;
+        encode_stream_fill(e, n, &samples[i]);
+    }
+    encode_stream_fini(e);
+
+    unsigned long seed = 1;
+    for (size_t i = 0; i < frames; i++) {
+        seed = seed * 1103515245 + 12345;
+        samples[i] += 0.02 * ((double)(seed >> 16 & 0x7fff) / 0x4000 - 1);
+    }
+
+    return samples;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the best of AUTOTUNE_RUNS times to decode `samples', or -1 on error
+static double time_decode(const struct audio_state *as, int channel, size_t frames,
+        const double samples[frames], size_t feed, struct decoded *d)
+{
+    double best = -1;
+    for (int run = 0; run < AUTOTUNE_RUNS; run++) {
+        struct stream_state *sd;
+        d->count = 0;
+        if (streamdecode_init(&sd, (struct audio_state *)as, d, collect, channel))
+            return -1;
+
+        double start = now();
+        int rc = 0;
+        for (size_t i = 0; i < frames && !rc; i += feed)
+            rc = streamdecode_process(sd, frames - i < feed ? frames - i : feed, &samples[i]);
+        double t = now() - start;
+        streamdecode_fini(sd);
+
+        if (rc)
+            return -1;
+        if (best < 0 || t < best)
+            best = t;
+    }
+
+    return best;
+}
+
+static int same_chars(const struct decoded *a, const struct decoded *b)
+{
+    size_t n = a->count < a->cap ? a->count : a->cap;
+    return a->count == b->count && !memcmp(a->chars, b->chars, n * sizeof *a->chars);
+}
+
+static int measure(const struct audio_state *as0, int channel, struct autotune_choice *c, int verbose)
+{
+    struct audio_state as = *as0;
+    const size_t frames = (size_t)as.sample_rate * AUTOTUNE_SECONDS;
+    double *samples = autotune_signal(&as, channel, frames);
+    if (!samples)
+        return -1;
+
+    const size_t cap = frames / SAMPLES_PER_BIT(&as) + 1;
+    struct decoded ref  = { .cap = cap, .chars = calloc(cap, sizeof *ref.chars)  };
+    struct decoded cand = { .cap = cap, .chars = calloc(cap, sizeof *cand.chars) };
+    int rc = ref.chars && cand.chars ? 0 : -1;
+
+    // the reference : the original kernel, fed as files are read
+    as.filter_kernel = FILTER_KERNEL_RING;
+    if (!rc && time_decode(&as, channel, frames, samples, FILEDECODE_BLOCK, &ref) < 0)
+        rc = -1;
+
+    *c = (struct autotune_choice){ .kernel = FILTER_KERNEL_RING, .feed = FILEDECODE_BLOCK };
+    double best = -1;
+    for (size_t k = 0; k < sizeof kernels / sizeof kernels[0] && !rc; k++) {
+        for (size_t f = 0; f < sizeof feeds / sizeof feeds[0] && !rc; f++) {
+            as.filter_kernel = kernels[k];
+            double t = time_decode(&as, channel, frames, samples, feeds[f], &cand);
+            if (t < 0) {
+                rc = -1;
+                break;
+            }
+
+            const int agrees = same_chars(&ref, &cand);
+            if (verbose)
+                fprintf(stderr, "autotune: %-6s feed %-4zu %8.3f ms%s\n",
+                        filter_kernel_name(kernels[k]), feeds[f], t * 1e3,
+                        agrees ? "" : " (output differs, passed over)");
+            if (agrees && (best < 0 || t < best)) {
+                best = t;
+                c->kernel = kernels[k];
+                c->feed   = feeds[f];
+            }
+        }
+    }
+
+    free(cand.chars);
+    free(ref.chars);
+    free(samples);
+
+    return rc;
+}
+
+int autotune(const char *cachefile, const struct audio_state *as, int channel,
+        struct autotune_choice *c, int verbose)
+{
+    char key[512];
+    cache_key(sizeof key, key, as, channel);
+
+    if (cachefile && !cache_lookup(cachefile, key, c))
+        return 1;
+
+    if (measure(as, channel, c, verbose))
+        return -1;
+
+    if (cachefile && cache_store(cachefile, key, c))
+        fprintf(stderr, "Warning, failed to write `%s' : %s\n", cachefile, strerror(errno));
+
+    return 0;
+}
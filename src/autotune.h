@@ -0,0 +1,34 @@
+#ifndef AUTOTUNE_H_
+#define AUTOTUNE_H_
+
+#include "filters.h"
+
+#include <stddef.h>
+
+struct audio_state;
+
+// How to run decoders fastest on this host : which filter kernel, and how many
+// frames to hand streamdecode_process at a time.
+struct autotune_choice {
+    enum filter_kernel kernel;
+    size_t feed;
+};
+
+// Fills in *c for decoders of `as' on `channel'. The answer comes from
+// `cachefile' if it has one for this CPU model, library version and set of
+// audio settings ; otherwise every combination is timed on a synthetic
+// signal, any whose characters differ from the reference kernel's is passed
+// over, and the fastest is added to `cachefile' (which can be NULL, for no
+// caching). Returns 1 for an answer from the cache, 0 for a fresh one, or -1
+// on error. With `verbose', the timings are reported on stderr.
+int autotune(const char *cachefile, const struct audio_state *as, int channel,
+        struct autotune_choice *c, int verbose);
+
+// The synthetic signal the timings are made on, for anything else that needs
+// a stand-in for real traffic : `frames' samples of text on `channel' of the
+// profile set in `as', sent back to back, with a little noise so that the
+// filters' rounding has something to work on. The same on every call ;
+// returns a malloc()ed array, or NULL on error.
+double *autotune_signal(const struct audio_state *as, int channel, size_t frames);
+
+#endif
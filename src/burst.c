@@ -0,0 +1,246 @@
+#define _XOPEN_SOURCE 600
+
+#include "burst.h"
+#include "audio.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BURST_INDEX_VERSION 2
+
+// share of a block's energy that must fall on a channel's two tones for the
+// block to count as carrier, and the quietest carrier worth reporting
+#define TONE_SHARE 0.25
+#define MIN_LEVEL  0.001
+
+struct burst_scan {
+    void *userdata;
+    burst_callback *cb;
+
+    unsigned block;         // samples per detection block
+    size_t gap;             // frames without carrier that end a burst
+    size_t minlen;          // frames a burst must last to be reported
+
+    // Goertzel filters, one per channel and tone
+    double coeff[2][2];
+    double s1[2][2], s2[2][2];
+    double energy;          // sum of squares over the current block
+    unsigned n;             // samples in the current block
+    size_t frame;           // frames seen so far
+
+    struct run {
+        int active;
+        size_t start, last; // first frame, and end of the last carrier block
+        double level;       // sum of per-block levels
+        unsigned blocks;
+    } run[2];
+};
+
+int burst_scan_init(struct burst_scan **bp, struct audio_state *as, void *ud, burst_callback *cb)
+{
+    struct burst_scan *b = *bp = calloc(1, sizeof *b);
+    if (!b)
+        return -1;
+
+    const double perbit = SAMPLES_PER_BIT(as);
+    int charbits = as->start_bits + as->data_bits + as->parity_bits + as->stop_bits;
+    if (charbits <= 0)
+        charbits = 11;
+
+    b->userdata = ud;
+    b->cb       = cb;
+    // one bit time gives a resolution of one baud, enough to separate the
+    // channels while catching both tones of a channel
+    b->block    = ceil(perbit);
+    b->gap      = charbits * perbit;
+    b->minlen   = charbits * perbit;
+
+    const double (*freqs)[2] = as->freqs ? as->freqs : bell103_freqs;
+    for (int c = 0; c < 2; c++)
+        for (int t = 0; t < 2; t++)
+            b->coeff[c][t] = 2 * cos(2 * M_PI * freqs[c][t] / as->sample_rate);
+
+    return 0;
+}
+
+static int close_run(struct burst_scan *b, int c)
+{
+    struct run *r = &b->run[c];
+    r->active = 0;
+    if (r->last - r->start < b->minlen)
+        return 0;
+
+    struct burst burst = {
+        .start   = r->start,
+        .end     = r->last,
+        .channel = c,
+        .level   = r->level / r->blocks,
+    };
+
+    return b->cb(b->userdata, &burst);
+}
+
+static int end_block(struct burst_scan *b)
+{
+    const size_t start = b->frame - b->n;
+    const double rms = sqrt(b->energy / b->n);
+    int rc = 0;
+
+    for (int c = 0; c < 2; c++) {
+        double power = 0;
+        for (int t = 0; t < 2; t++) {
+            double s1 = b->s1[c][t], s2 = b->s2[c][t];
+            power += s1 * s1 + s2 * s2 - b->coeff[c][t] * s1 * s2;
+            b->s1[c][t] = b->s2[c][t] = 0;
+        }
+
+        // a pure tone of amplitude A gives power (A n / 2)^2 and energy A^2 n / 2
+        double share = b->energy > 0 ? power / (b->energy * b->n / 2) : 0;
+        struct run *r = &b->run[c];
+        if (share > TONE_SHARE && rms > MIN_LEVEL) {
+            if (!r->active) {
+                r->active = 1;
+                r->start  = start;
+                r->level  = 0;
+                r->blocks = 0;
+            }
+            r->last = b->frame;
+            r->level += sqrt(2 * power) / b->n;
+            r->blocks++;
+        } else if (r->active && b->frame - r->last > b->gap) {
+            rc |= close_run(b, c);
+        }
+    }
+
+    b->energy = 0;
+    b->n = 0;
+
+    return rc;
+}
+
+int burst_scan_process(struct burst_scan *b, size_t count, const double samples[count])
+{
+    for (size_t i = 0; i < count; i++) {
+        double x = samples[i];
+        for (int c = 0; c < 2; c++) {
+            for (int t = 0; t < 2; t++) {
+                double s = x + b->coeff[c][t] * b->s1[c][t] - b->s2[c][t];
+                b->s2[c][t] = b->s1[c][t];
+                b->s1[c][t] = s;
+            }
+        }
+        b->energy += x * x;
+        b->frame++;
+
+        if (++b->n == b->block && end_block(b))
+            return -1;
+    }
+
+    return 0;
+}
+
+int burst_scan_finish(struct burst_scan *b)
+{
+    int rc = 0;
+    if (b->n)
+        rc |= end_block(b);
+
+    for (int c = 0; c < 2; c++)
+        if (b->run[c].active)
+            rc |= close_run(b, c);
+
+    return rc;
+}
+
+int burst_scan_carrier(struct burst_scan *b, int channel, size_t *frames)
+{
+    const struct run *r = &b->run[channel];
+    *frames = r->active ? r->last - r->start : 0;
+    return r->active;
+}
+
+void burst_scan_fini(struct burst_scan *b)
+{
+    free(b);
+}
+
+int burst_collect(void *userdata, const struct burst *b)
+{
+    struct burst_list *l = userdata;
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 64;
+        struct burst *bursts = realloc(l->bursts, cap * sizeof *bursts);
+        if (!bursts)
+            return -1;
+        l->bursts = bursts;
+        l->cap = cap;
+    }
+
+    l->bursts[l->count++] = *b;
+
+    return 0;
+}
+
+// the header line of an index of `frames' frames scanned with `as' ; the same
+// text is written and then expected back, so a value must print the same way
+static void index_header(size_t len, char header[len], const struct audio_state *as, size_t frames)
+{
+    const double (*freqs)[2] = as->freqs ? as->freqs : bell103_freqs;
+    snprintf(header, len, "# tynsel bursts %d rate %u frames %zu baud %u freqs %g/%g/%g/%g\n",
+            BURST_INDEX_VERSION, as->sample_rate, frames, as->baud_rate,
+            freqs[0][0], freqs[0][1], freqs[1][0], freqs[1][1]);
+}
+
+int burst_index_write(const char *filename, const struct audio_state *as, size_t frames, size_t count, const struct burst bursts[count])
+{
+    FILE *f = fopen(filename, "w");
+    if (!f)
+        return -1;
+
+    char header[256];
+    index_header(sizeof header, header, as, frames);
+    fputs(header, f);
+    for (size_t i = 0; i < count; i++)
+        fprintf(f, "%zu %zu %d %g\n", bursts[i].start, bursts[i].end, bursts[i].channel, bursts[i].level);
+
+    return fclose(f) ? -1 : 0;
+}
+
+int burst_index_read(const char *filename, const struct audio_state *as, size_t frames, size_t *count, struct burst **bursts)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f)
+        return -1;
+
+    char want[256], line[256];
+    index_header(sizeof want, want, as, frames);
+    if (!fgets(line, sizeof line, f) || strcmp(line, want)) {
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct burst_list l = { .count = 0 };
+    struct burst b;
+    int rc = 0;
+    while (!rc && fscanf(f, "%zu %zu %d %lf\n", &b.start, &b.end, &b.channel, &b.level) == 4)
+        rc = burst_collect(&l, &b);
+
+    if (!rc && !feof(f))
+        rc = -1;
+    fclose(f);
+    if (rc) {
+        free(l.bursts);
+        errno = EINVAL;
+        return -1;
+    }
+
+    *count = l.count;
+    *bursts = l.bursts;
+
+    return 0;
+}
+
@@ -0,0 +1,50 @@
+#ifndef BURST_H_
+#define BURST_H_
+
+#include "tynsel_api.h"
+
+#include <stddef.h>
+
+struct audio_state;
+
+// A stretch of carrier on one modem channel
+struct burst {
+    size_t start, end;  // frames, end exclusive
+    int channel;
+    double level;       // RMS amplitude of the carrier
+};
+
+// called for each burst, in order of their end frames
+typedef int burst_callback(void *userdata, const struct burst *b);
+
+// a burst_callback that appends to a `struct burst_list' passed as userdata
+struct burst_list {
+    struct burst *bursts;
+    size_t count, cap;
+};
+TYNSEL_API int burst_collect(void *userdata, const struct burst *b);
+
+struct burst_scan;
+
+// `as' must have its sample rate, baud rate and frequencies filled in
+TYNSEL_API int burst_scan_init(struct burst_scan **bp, struct audio_state *as, void *ud, burst_callback *cb);
+TYNSEL_API int burst_scan_process(struct burst_scan *b, size_t count, const double samples[count]);
+// reports any burst still in progress
+TYNSEL_API int burst_scan_finish(struct burst_scan *b);
+// whether a burst is in progress on `channel' as of the samples processed so
+// far, and if so how many frames of carrier it has had ; a burst outlasts its
+// carrier by the gap that ends it, so a brief dropout does not end it
+TYNSEL_API int burst_scan_carrier(struct burst_scan *b, int channel, size_t *frames);
+TYNSEL_API void burst_scan_fini(struct burst_scan *b);
+
+// A burst index is a text file with one `start end channel level' line per
+// burst, after a header recording the length of the scanned file and what
+// the scan depended on in `as' (its sample rate, baud rate and frequencies),
+// so that stale indexes can be detected.
+TYNSEL_API int burst_index_write(const char *filename, const struct audio_state *as, size_t frames, size_t count, const struct burst bursts[count]);
+// returns -1 if the index is missing, malformed or does not match `as' and
+// `frames' ; on success *bursts is malloc()ed
+TYNSEL_API int burst_index_read(const char *filename, const struct audio_state *as, size_t frames, size_t *count, struct burst **bursts);
+
+#endif
+
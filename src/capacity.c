@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2012-2014 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#define _XOPEN_SOURCE 700
+
+#include "tynsel.h"
+#include "autotune.h"
+#include "hist.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Finds how many lines a host can decode live : each simulated line is fed
+// frames of modem audio at wall-clock pace, each frame due to be decoded
+// before the next one arrives, and the number of lines is raised until too
+// many frames miss that deadline.
+
+// seconds of audio made up front, which every line loops over
+#define AUDIO_SECONDS 10
+// a worker this far behind its lines cannot catch up ; the rest of its
+// frames are counted as missed without being decoded
+#define GIVE_UP_NS 2000000000ull
+// how close to a frame's arrival a worker stops sleeping and spins on
+#define SPIN_NS 50000ull
+
+struct cap_opts {
+    unsigned sample_rate;
+    enum fsk_profile profile;
+    int channel;
+    enum filter_kernel kernel;
+    unsigned threads;
+    unsigned frame_ms;
+    double seconds;         // of decoding at each number of lines
+    unsigned first, max;    // lines to start the ramp at, and never to pass
+    unsigned fixed;         // lines to run at instead of ramping, if nonzero
+    double miss_limit;      // the fraction of frames that may miss
+};
+
+struct line {
+    struct stream_state *sd;
+    struct worker *w;
+    size_t pos;                 // in the shared audio, of its next frame
+    unsigned long long phase;   // its frames arrive this long into each period
+    unsigned long long arrival; // of the frame being decoded
+};
+
+struct worker {
+    struct level *lv;
+    pthread_t tid;
+    unsigned count;
+    struct line *lines;         // in order of phase
+
+    unsigned long long frames, missed, chars, cpu_ns;
+    int failed;                 // a decoder returned an error
+    struct hist response_ns;    // from a frame's arrival to its decoding
+    struct hist latency_ns;     // from the arrival of a character's last frame to its callback
+};
+
+// one run at a fixed number of lines
+struct level {
+    const struct cap_opts *o;
+    struct audio_state as;
+    const double *audio;
+    size_t audio_len;
+    size_t frame;               // samples in a frame
+    unsigned long long period_ns, start_ns;
+    unsigned long long periods; // frames each line gets
+    int stop;                   // set when the run is abandoned, read by every worker
+};
+
+struct level_result {
+    unsigned lines;
+    double wall, cpu;           // seconds, and the share of the workers' time busy
+    unsigned long long frames, missed, chars;
+    struct hist response_ns, latency_ns;
+};
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned long long thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long ns)
+{
+    struct timespec ts = { .tv_sec = ns / 1000000000ull, .tv_nsec = ns % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void hist_merge(struct hist *into, const struct hist *h)
+{
+    into->count += h->count;
+    if (h->max > into->max)
+        into->max = h->max;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++)
+        into->bucket[b] += h->bucket[b];
+}
+
+static int emit(void *userdata, int status, int data)
+{
+    (void)status;
+    (void)data;
+    struct line *l = userdata;
+    struct worker *w = l->w;
+    // the character was completed by a sample in the frame being decoded
+    hist_add(&w->latency_ns, now_ns() - l->arrival);
+    w->chars++;
+
+    return 0;
+}
+
+// decodes the next frame of `l', which may wrap around the end of the audio
+static int decode_frame(const struct level *lv, struct line *l)
+{
+    size_t left = lv->frame;
+    while (left > 0) {
+        size_t n = lv->audio_len - l->pos < left ? lv->audio_len - l->pos : left;
+        if (streamdecode_process(l->sd, n, &lv->audio[l->pos]))
+            return -1;
+        l->pos = (l->pos + n) % lv->audio_len;
+        left -= n;
+    }
+
+    return 0;
+}
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = arg;
+    struct level *lv = w->lv;
+    const unsigned long long cpu0 = thread_cpu_ns();
+
+    for (unsigned long long p = 0; p < lv->periods; p++) {
+        if (__atomic_load_n(&lv->stop, __ATOMIC_RELAXED))
+            break;
+        for (unsigned i = 0; i < w->count; i++) {
+            struct line *l = &w->lines[i];
+            l->arrival = lv->start_ns + p * lv->period_ns + l->phase;
+
+            unsigned long long now = now_ns();
+            if (now + SPIN_NS < l->arrival)
+                sleep_until(l->arrival - SPIN_NS);
+            while ((now = now_ns()) < l->arrival)
+                ;
+            if (now - l->arrival > GIVE_UP_NS) {
+                const unsigned long long left = (lv->periods - p) * w->count - i;
+                w->frames += left;
+                w->missed += left;
+                goto done;
+            }
+
+            if (decode_frame(lv, l)) {
+                // the others need not finish a run that will be thrown away
+                w->failed = 1;
+                __atomic_store_n(&lv->stop, 1, __ATOMIC_RELAXED);
+                goto done;
+            }
+
+            const unsigned long long response = now_ns() - l->arrival;
+            hist_add(&w->response_ns, response);
+            w->frames++;
+            // due before the line's next frame arrives
+            w->missed += response > lv->period_ns;
+        }
+    }
+
+done:
+    w->cpu_ns = thread_cpu_ns() - cpu0;
+    return NULL;
+}
+
+// runs `lines' lines for a level's time ; a failure is reported here, and
+// returns -1
+static int run_level(const struct level *tmpl, unsigned lines, struct level_result *r)
+{
+    const struct cap_opts *o = tmpl->o;
+    struct level lv = *tmpl;
+    const unsigned threads = o->threads < lines ? o->threads : lines;
+
+    struct line *all = calloc(lines, sizeof *all);
+    struct worker *workers = calloc(threads, sizeof *workers);
+    unsigned ready = 0;         // lines with a decoder
+    int rc = 0;
+    if (!all || !workers) {
+        fprintf(stderr, "Failed to set up %u lines : %s\n", lines, strerror(errno));
+        rc = -1;
+        goto out;
+    }
+
+    // line g arrives g / lines of the way through each period, and reads the
+    // audio from a point of its own ; worker t takes lines t, t + threads and
+    // so on, so that each has arrivals spread across the period
+    for (unsigned t = 0; t < threads && !rc; t++) {
+        struct worker *w = &workers[t];
+        w->lv    = &lv;
+        w->lines = &all[ready];
+        w->count = lines / threads + (t < lines % threads);
+        for (unsigned i = 0; i < w->count; i++) {
+            struct line *l = &w->lines[i];
+            const unsigned g = i * threads + t;
+            l->w     = w;
+            l->phase = lv.period_ns * g / lines;
+            l->pos   = (size_t)((double)lv.audio_len * g / lines);
+            if (streamdecode_init(&l->sd, &lv.as, l, emit, o->channel)) {
+                fprintf(stderr, "Failed to set up %u lines : %s\n", lines, strerror(errno));
+                rc = -1;
+                break;
+            }
+            ready++;
+        }
+    }
+    if (rc)
+        goto out;
+
+    lv.periods  = o->seconds * 1000 / o->frame_ms;
+    lv.start_ns = now_ns() + 100000000ull; // time for every worker to start
+
+    // the workers that did start are stopped early and joined before going
+    // on, whether or not the rest could be
+    unsigned started = 0;
+    int err = 0;
+    while (started < threads && !(err = pthread_create(&workers[started].tid, NULL, worker_run, &workers[started])))
+        started++;
+    if (started < threads) {
+        __atomic_store_n(&lv.stop, 1, __ATOMIC_RELAXED);
+        fprintf(stderr, "Failed to start %u threads : %s\n", threads, strerror(err));
+        rc = -1;
+    }
+    for (unsigned t = 0; t < started; t++) {
+        pthread_join(workers[t].tid, NULL);
+        if (workers[t].failed && !rc) {
+            fprintf(stderr, "Decoding failed at %u lines\n", lines);
+            rc = -1;
+        }
+    }
+    const unsigned long long end_ns = now_ns();
+    if (rc)
+        goto out;
+
+    memset(r, 0, sizeof *r);
+    r->lines = lines;
+    r->wall  = (end_ns - lv.start_ns) / 1e9;
+    unsigned long long cpu_ns = 0;
+    for (unsigned t = 0; t < threads; t++) {
+        const struct worker *w = &workers[t];
+        r->frames        += w->frames;
+        r->missed        += w->missed;
+        r->chars         += w->chars;
+        cpu_ns           += w->cpu_ns;
+        hist_merge(&r->response_ns, &w->response_ns);
+        hist_merge(&r->latency_ns, &w->latency_ns);
+    }
+    r->cpu = r->wall > 0 ? cpu_ns / 1e9 / (r->wall * threads) : 0;
+
+out:
+    for (unsigned k = 0; k < ready; k++)
+        streamdecode_fini(all[k].sd);
+    free(workers);
+    free(all);
+
+    return rc;
+}
+
+static void print_hist(FILE *f, const char *name, const struct hist *h, double unit)
+{
+    fprintf(f, " %s %.1f/%.1f/%.1f/%.1f", name,
+               hist_percentile(h, 50) / unit, hist_percentile(h, 90) / unit,
+               hist_percentile(h, 99) / unit, h->max / unit);
+}
+
+// one line per level ; timings are p50/p90/p99/max
+static void print_level(FILE *f, const struct level_result *r)
+{
+    fprintf(f, "lines %u frames %llu missed %llu (%.4f%%) cpu %.1f%%",
+               r->lines, r->frames, r->missed,
+               r->frames ? 100. * r->missed / r->frames : 0., 100 * r->cpu);
+    print_hist(f, "response_us", &r->response_ns, 1e3);
+    print_hist(f, "latency_ms", &r->latency_ns, 1e6);
+    fprintf(f, " chars %llu\n", r->chars);
+    fflush(f);
+}
+
+static int sustainable(const struct cap_opts *o, const struct level_result *r)
+{
+    return r->frames && (double)r->missed / r->frames <= o->miss_limit;
+}
+
+static int parse_opts(struct cap_opts *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "s:p:C:K:j:f:d:n:N:l:m:")) != -1) {
+        switch (ch) {
+            case 's': o->sample_rate = strtoul(optarg, NULL, 0); break;
+            case 'C': o->channel     = strtol(optarg, NULL, 0);  break;
+            case 'j': o->threads     = strtoul(optarg, NULL, 0); break;
+            case 'f': o->frame_ms    = strtoul(optarg, NULL, 0); break;
+            case 'd': o->seconds     = strtod(optarg, NULL);     break;
+            case 'n': o->first       = strtoul(optarg, NULL, 0); break;
+            case 'N': o->max         = strtoul(optarg, NULL, 0); break;
+            case 'l': o->fixed       = strtoul(optarg, NULL, 0); break;
+            case 'm': o->miss_limit  = strtod(optarg, NULL);     break;
+            case 'p':
+                if (fsk_profile_parse(optarg, &o->profile)) {
+                    fprintf(stderr, "Unknown modem profile `%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'K':
+                if (filter_kernel_parse(optarg, &o->kernel)) {
+                    fprintf(stderr, "Unknown filter kernel `%s'\n", optarg);
+                    return -1;
+                }
+                break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct cap_opts opts = {
+        .sample_rate = 8000,
+        .profile     = FSK_PROFILE_BELL103,
+        .channel     = 1,
+        .kernel      = FILTER_KERNEL_DEFAULT,
+        .threads     = 0,
+        .frame_ms    = 20,
+        .seconds     = 10,
+        .first       = 0,
+        .max         = 1 << 16,
+        .fixed       = 0,
+        .miss_limit  = 0.001,
+    };
+    if (parse_opts(&opts, argc, argv))
+        return EXIT_FAILURE;
+
+    if (opts.sample_rate == 0 || opts.frame_ms == 0 || opts.seconds <= 0 ||
+            (opts.channel != 0 && opts.channel != 1)) {
+        fprintf(stderr, "Bad sample rate, frame length, duration or channel\n");
+        return EXIT_FAILURE;
+    }
+    if (!opts.threads) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.threads = n > 0 ? n : 1;
+    }
+    if (!opts.first)
+        opts.first = opts.threads;
+    if (opts.first > opts.max) {
+        fprintf(stderr, "The ramp starts above its limit\n");
+        return EXIT_FAILURE;
+    }
+
+    struct level lv = {
+        .o = &opts,
+        .as = {
+            .sample_rate = opts.sample_rate,
+            .start_bits  = 1,
+            .data_bits   = 7,
+            .stop_bits   = 2,
+            .parity_bits = 1,
+            .filter_kernel = opts.kernel,
+        },
+        .audio_len = (size_t)opts.sample_rate * AUDIO_SECONDS,
+        .frame     = (size_t)opts.sample_rate * opts.frame_ms / 1000,
+        .period_ns = opts.frame_ms * 1000000ull,
+    };
+    audio_set_profile(&lv.as, opts.profile);
+    if (!lv.frame) {
+        fprintf(stderr, "Frames of %u ms hold no samples\n", opts.frame_ms);
+        return EXIT_FAILURE;
+    }
+
+    double *audio = autotune_signal(&lv.as, opts.channel, lv.audio_len);
+    if (!audio) {
+        fprintf(stderr, "Failed to make audio : %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    lv.audio = audio;
+
+    printf("# %u Hz %s channel %d, %u ms frames, %u threads, %.0f s per level, miss limit %g%%\n",
+           opts.sample_rate, fsk_profile_info(opts.profile)->name, opts.channel,
+           opts.frame_ms, opts.threads, opts.seconds, 100 * opts.miss_limit);
+
+    struct level_result r;
+    int rc = 0;
+    if (opts.fixed) {
+        if (!(rc = run_level(&lv, opts.fixed, &r)))
+            print_level(stdout, &r);
+        free(audio);
+        return rc ? EXIT_FAILURE : 0;
+    }
+
+    // double the lines until too many frames miss, then close in on the
+    // most that do not, to within a twentieth
+    unsigned good = 0, bad = 0;
+    for (unsigned n = opts.first; !rc && !bad && n <= opts.max; n = n > opts.max / 2 ? opts.max + 1 : n * 2) {
+        if (!(rc = run_level(&lv, n, &r))) {
+            print_level(stdout, &r);
+            if (sustainable(&opts, &r))
+                good = n;
+            else
+                bad = n;
+        }
+    }
+    while (!rc && bad && bad - good > 1 && (bad - good) * 20 > bad) {
+        const unsigned n = good + (bad - good) / 2;
+        if (!(rc = run_level(&lv, n, &r))) {
+            print_level(stdout, &r);
+            if (sustainable(&opts, &r))
+                good = n;
+            else
+                bad = n;
+        }
+    }
+    free(audio);
+
+    if (rc)
+        return EXIT_FAILURE;
+    if (!good) {
+        printf("capacity : fewer than %u lines on %u threads\n", opts.first, opts.threads);
+        return 0;
+    }
+    printf("capacity : %u lines on %u threads, %.1f per core%s\n", good, opts.threads,
+           (double)good / opts.threads, bad ? "" : " (the most tried)");
+
+    return 0;
+}
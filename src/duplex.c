@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2012-2014 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+// Runs an originating and an answering session against each other over a
+// simulated line, as a demonstration and check of the session engine : both
+// hear the sum of what both send, one frame late.
+
+#include "session.h"
+#include "audio.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sndfile.h>
+
+// frames per tick, as a media thread would deliver them
+#define TICK_MS 20
+// line time after both sides have sent everything
+#define TAIL_MS 500
+
+struct duplex_opts {
+    unsigned rate;
+    unsigned seconds;       // give up after this much line time
+    const char *filename;   // records the line
+};
+
+struct side {
+    const char *name;
+    struct session *s;
+    const char *text;
+    double *out;
+};
+
+static int emit(void *userdata, int status, int data)
+{
+    struct side *d = userdata;
+    switch (status) {
+        case STREAM_ERR_OK:
+            printf("%s char '%c' (%d)\n", d->name, data, data);
+            break;
+        case STREAM_ERR_PARITY:
+            printf("%s char '%c' (%d) (PARITY FAILED)\n", d->name, data, data);
+            break;
+        default:
+            printf("%s unknown error\n", d->name);
+            break;
+    }
+
+    return 0;
+}
+
+static void state_changed(void *userdata, enum session_state state)
+{
+    struct side *d = userdata;
+    printf("%s %s\n", d->name, session_state_name(state));
+}
+
+static int parse_opts(struct duplex_opts *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "s:t:o:")) != -1) {
+        switch (ch) {
+            case 's': o->rate     = strtol(optarg, NULL, 0); break;
+            case 't': o->seconds  = strtol(optarg, NULL, 0); break;
+            case 'o': o->filename = optarg;                  break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    if (o->rate < 1000) {
+        fprintf(stderr, "Sample rate %u is too low\n", o->rate);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct duplex_opts opts = {
+        .rate     = 8000,
+        .seconds  = 30,
+        .filename = NULL,
+    };
+    if (parse_opts(&opts, argc, argv))
+        return 1;
+
+    struct audio_state as = {
+        .sample_rate = opts.rate,
+        .baud_rate   = 300,
+        .start_bits  = 1,
+        .data_bits   = 7,
+        .parity_bits = 1,
+        .stop_bits   = 2,
+        .freqs       = bell103_freqs,
+    };
+
+    const size_t tick = opts.rate * TICK_MS / 1000;
+    double *line = calloc(tick, sizeof *line);
+    struct side sides[2] = {
+        { .name = "originate", .text = optind     < argc ? argv[optind    ] : "" },
+        { .name = "answer"   , .text = optind + 1 < argc ? argv[optind + 1] : "" },
+    };
+
+    int rc = line ? 0 : -1;
+    for (int i = 0; i < 2 && !rc; i++) {
+        struct side *d = &sides[i];
+        d->out = calloc(tick, sizeof *d->out);
+        if (!d->out || session_init(&d->s, &as, i ? SESSION_ANSWER : SESSION_ORIGINATE,
+                                    0.5, strlen(d->text) + 1, d, emit, state_changed)) {
+            rc = -1;
+            break;
+        }
+        session_send(d->s, strlen(d->text), (const unsigned char *)d->text);
+    }
+    if (rc) {
+        fprintf(stderr, "Failed to set up sessions\n");
+        return 1;
+    }
+
+    SNDFILE *sf = NULL;
+    if (opts.filename) {
+        SF_INFO sinfo = {
+            .samplerate = opts.rate,
+            .channels   = 1,
+            .format     = SF_FORMAT_WAV | SF_FORMAT_PCM_16,
+        };
+        sf = sf_open(opts.filename, SFM_WRITE, &sinfo);
+        if (!sf) {
+            fprintf(stderr, "Failed to open `%s' : %s\n", opts.filename, sf_strerror(NULL));
+            return 1;
+        }
+    }
+
+    const size_t limit = (size_t)opts.rate * opts.seconds;
+    size_t done = 0;    // frames since both sides finished sending
+    for (size_t frame = 0; frame < limit && done < opts.rate * TAIL_MS / 1000; frame += tick) {
+        for (size_t i = 0; i < tick; i++)
+            line[i] = sides[0].out[i] + sides[1].out[i];
+        if (sf)
+            sf_write_double(sf, line, tick);
+
+        int finished = 1;
+        for (int i = 0; i < 2; i++) {
+            struct side *d = &sides[i];
+            if (session_process(d->s, tick, line, d->out))
+                rc = -1;
+            enum session_state st = session_state(d->s);
+            if (st == SESSION_LOST || st == SESSION_TIMEOUT)
+                rc = -1;
+            finished &= st == SESSION_CONNECTED && !session_busy(d->s);
+        }
+        if (rc)
+            break;
+        done = finished ? done + tick : 0;
+    }
+
+    if (!rc && !done) {
+        fprintf(stderr, "Gave up after %u seconds\n", opts.seconds);
+        rc = -1;
+    }
+
+    if (sf)
+        sf_close(sf);
+    for (int i = 0; i < 2; i++) {
+        session_fini(sides[i].s);
+        free(sides[i].out);
+    }
+    free(line);
+
+    return rc ? 1 : 0;
+}
+
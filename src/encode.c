@@ -23,20 +23,17 @@
 #define _XOPEN_SOURCE 600
 
 #include "encode.h"
+#include "ring.h"
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 // TODO redefine POPCNT for different compilers than GCC
 #define POPCNT(x) __builtin_popcount(x)
 
-struct put_state {
-    int last_quadrant;
-    double last_sample;
-    double adjust;
-};
-
-static int encode_sample(struct encode_state *s, double freq, double gain, double sample_index, struct put_state *state)
+static int encode_sample(struct encode_state *s, double freq, double gain, double sample_index, struct encode_phase *state)
 {
     double proportion = sample_index / s->audio.sample_rate;
     double radians = proportion * 2. * M_PI;
@@ -48,7 +45,7 @@ static int encode_sample(struct encode_state *s, double freq, double gain, doubl
     return rc ? 1 : -1;
 }
 
-static int encode_bit(struct encode_state *s, double freq, double gain, struct put_state *state)
+static int encode_bit(struct encode_state *s, double freq, double gain, struct encode_phase *state)
 {
     int samples = 0;
 
@@ -85,11 +82,10 @@ int encode_carrier(struct encode_state *s, size_t bit_times)
     int samples = 0;
     int rc = 0;
 
-    struct put_state state = { .last_quadrant = 0 };
     double gains[] = { s->bitamp ? .7 : 1., 1. };
 
     for (unsigned bit_index = 0; rc >= 0 && bit_index < bit_times; bit_index++) {
-        rc = encode_bit(s, s->audio.freqs[s->channel][1], s->gain * gains[1], &state);
+        rc = encode_bit(s, s->audio.freqs[s->channel][1], s->gain * gains[1], &s->phase);
         if (rc >= 0) samples += rc; else return -1;
     }
 
@@ -101,7 +97,6 @@ int encode_bytes(struct encode_state *s, size_t byte_count, unsigned bytes[byte_
     int samples = 0;
     int rc = 0;
 
-    struct put_state state = { .last_quadrant = 0 };
     for (unsigned byte_index = 0; byte_index < byte_count; byte_index++) {
         unsigned byte = bytes[byte_index];
         if (s->verbosity)
@@ -110,26 +105,26 @@ int encode_bytes(struct encode_state *s, size_t byte_count, unsigned bytes[byte_
         double gains[] = { s->bitamp ? .7 : 1., 1. };
 
         for (int bit_index = 0; rc >= 0 && bit_index < s->audio.start_bits; bit_index++) {
-            rc = encode_bit(s, s->audio.freqs[s->channel][0], s->gain * gains[0], &state);
+            rc = encode_bit(s, s->audio.freqs[s->channel][0], s->gain * gains[0], &s->phase);
             if (rc >= 0) samples += rc; else return -1;
         }
 
         for (int bit_index = 0; rc >= 0 && bit_index < s->audio.data_bits; bit_index++) {
             unsigned bit = !!(byte & (1 << bit_index));
             double freq = s->audio.freqs[s->channel][bit];
-            rc = encode_bit(s, freq, s->gain * gains[bit], &state);
+            rc = encode_bit(s, freq, s->gain * gains[bit], &s->phase);
             if (rc >= 0) samples += rc; else return -1;
         }
 
         int oddness = POPCNT(byte) & 1;
         for (int bit_index = 0; rc >= 0 && bit_index < s->audio.parity_bits; bit_index++) {
             // assume EVEN parity for now
-            rc = encode_bit(s, s->audio.freqs[s->channel][oddness], s->gain * gains[1], &state);
+            rc = encode_bit(s, s->audio.freqs[s->channel][oddness], s->gain * gains[1], &s->phase);
             if (rc >= 0) samples += rc; else return -1;
         }
 
         for (int bit_index = 0; rc >= 0 && bit_index < s->audio.stop_bits; bit_index++) {
-            rc = encode_bit(s, s->audio.freqs[s->channel][1], s->gain * gains[1], &state);
+            rc = encode_bit(s, s->audio.freqs[s->channel][1], s->gain * gains[1], &s->phase);
             if (rc >= 0) samples += rc; else return -1;
         }
     }
@@ -138,3 +133,127 @@ int encode_bytes(struct encode_state *s, size_t byte_count, unsigned bytes[byte_
 }
 
 
+
+struct encode_stream {
+    struct audio_state audio;
+    unsigned channel;
+    double gain;
+    int bitamp;
+
+    struct ring *queue;
+    int mode;           // an enum encode_stream_mode
+    unsigned bits[32];  // frequency indices of the character being sent
+    int nbits, bit;     // bits in it, and the one being sent
+    int sending;        // whether a character is under way ; the one field
+                        // here that encode_stream_busy reads
+    double left;        // samples left in the current bit
+    double phase;       // of the carrier, in cycles
+};
+
+int encode_stream_init(struct encode_stream **ep, const struct encode_state *s, size_t queue)
+{
+    const struct audio_state *a = &s->audio;
+    if (a->start_bits + a->data_bits + a->parity_bits + a->stop_bits > 32)
+        return -1;
+
+    struct encode_stream *e = *ep = calloc(1, sizeof *e);
+    if (!e)
+        return -1;
+
+    e->queue = ring_create(1, queue);
+    if (!e->queue) {
+        free(e);
+        return -1;
+    }
+
+    memcpy(&e->audio, a, sizeof *a);
+    e->channel = s->channel;
+    e->gain    = s->gain;
+    e->bitamp  = s->bitamp;
+    e->mode    = ENCODE_STREAM_DATA;
+
+    return 0;
+}
+
+size_t encode_stream_queue(struct encode_stream *e, size_t count, const unsigned char bytes[count])
+{
+    return ring_write(e->queue, count, bytes);
+}
+
+// lays out the next queued byte as bits, the same way encode_bytes does
+static int next_char(struct encode_stream *e)
+{
+    // marked as sending before the byte leaves the queue, so that a caller
+    // of encode_stream_busy that finds the queue empty sees it being sent
+    if (!ring_used(e->queue))
+        return -1;
+    __atomic_store_n(&e->sending, 1, __ATOMIC_RELEASE);
+    unsigned char byte;
+    if (ring_get(e->queue, &byte))
+        return -1;
+
+    const struct audio_state *a = &e->audio;
+    int n = 0;
+    for (int i = 0; i < a->start_bits; i++)
+        e->bits[n++] = 0;
+    for (int i = 0; i < a->data_bits; i++)
+        e->bits[n++] = !!(byte & (1 << i));
+    for (int i = 0; i < a->parity_bits; i++)
+        e->bits[n++] = POPCNT(byte) & 1; // EVEN parity
+    for (int i = 0; i < a->stop_bits; i++)
+        e->bits[n++] = 1;
+
+    e->nbits = n;
+    e->bit   = 0;
+
+    return 0;
+}
+
+void encode_stream_fill(struct encode_stream *e, size_t count, double samples[count])
+{
+    const double perbit = SAMPLES_PER_BIT(&e->audio);
+    const int mode = __atomic_load_n(&e->mode, __ATOMIC_RELAXED);
+    size_t i = 0;
+    while (i < count) {
+        if (e->left < 0.5) {
+            // move on to the next bit, keeping the fraction of a sample
+            // left over so that bit edges do not drift
+            e->left += perbit;
+            if (e->bit < e->nbits)
+                e->bit++;
+            if (e->bit >= e->nbits && (mode != ENCODE_STREAM_DATA || next_char(e))) {
+                e->nbits = e->bit = 0; // idle on mark
+                __atomic_store_n(&e->sending, 0, __ATOMIC_RELEASE);
+            }
+        }
+
+        const int idle = e->bit >= e->nbits;
+        const unsigned bit = idle ? 1 : e->bits[e->bit];
+        const double step = e->audio.freqs[e->channel][bit] / e->audio.sample_rate;
+        const double gain = idle && mode == ENCODE_STREAM_SILENT ? 0 :
+                            e->gain * (e->bitamp && !bit ? .7 : 1.);
+        for (; i < count && e->left >= 0.5; i++, e->left--) {
+            samples[i] = sin(2 * M_PI * e->phase) * gain;
+            e->phase += step;
+            e->phase -= floor(e->phase);
+        }
+    }
+}
+
+int encode_stream_busy(struct encode_stream *e)
+{
+    // the queue first : a byte taken from it is already marked as sending
+    return ring_used(e->queue) || __atomic_load_n(&e->sending, __ATOMIC_ACQUIRE);
+}
+
+void encode_stream_set_mode(struct encode_stream *e, enum encode_stream_mode mode)
+{
+    __atomic_store_n(&e->mode, mode, __ATOMIC_RELAXED);
+}
+
+void encode_stream_fini(struct encode_stream *e)
+{
+    ring_destroy(e->queue);
+    free(e);
+}
+
@@ -23,10 +23,20 @@
 #ifndef ENCODE_H_
 #define ENCODE_H_
 
+#include "tynsel_api.h"
+
 #include "audio.h"
 
 #include <stddef.h>
 
+// where the last bit left the carrier, so that the next one can continue
+// from the same phase
+struct encode_phase {
+    int last_quadrant;
+    double last_sample;
+    double adjust;
+};
+
 struct encode_state {
     struct audio_state audio;
     int verbosity;
@@ -38,11 +48,40 @@ struct encode_state {
     } cb;
     int bitamp; // whether to differentiate amplitude in bits (hack)
     int index, length; // sample offset and length (for silence at ends)
+    struct encode_phase phase; // carried across calls, so that chunks join up
 };
 
-// returns number of samples emitted, or -1
-int encode_bytes(struct encode_state *s, size_t byte_count, unsigned bytes[byte_count]);
-int encode_carrier(struct encode_state *s, size_t bit_times);
+// returns number of samples emitted, or -1 ; a long payload can be passed in
+// chunks, giving the same samples as passing it all at once
+TYNSEL_API int encode_bytes(struct encode_state *s, size_t byte_count, unsigned bytes[byte_count]);
+TYNSEL_API int encode_carrier(struct encode_state *s, size_t bit_times);
+
+// A pull-model modulator : bytes are queued from one thread and samples are
+// pulled by another, typically a media thread, which gets mark carrier
+// whenever the queue is empty. Only `audio', `channel', `gain' and `bitamp'
+// are taken from the encode_state.
+struct encode_stream;
+
+// `queue' is the number of bytes that can wait to be sent
+TYNSEL_API int encode_stream_init(struct encode_stream **ep, const struct encode_state *s, size_t queue);
+// never blocks ; returns the number of bytes queued
+TYNSEL_API size_t encode_stream_queue(struct encode_stream *e, size_t count, const unsigned char bytes[count]);
+// never blocks ; fills `samples' with the next `count' samples
+TYNSEL_API void encode_stream_fill(struct encode_stream *e, size_t count, double samples[count]);
+// whether any byte is queued or still being sent
+TYNSEL_API int encode_stream_busy(struct encode_stream *e);
+
+// What the stream sends : nothing, mark carrier without taking bytes from the
+// queue, or queued bytes on mark carrier (the default). A change takes effect
+// at the end of the character being sent.
+enum encode_stream_mode {
+    ENCODE_STREAM_SILENT,
+    ENCODE_STREAM_MARK,
+    ENCODE_STREAM_DATA,
+};
+// may be called from any thread
+TYNSEL_API void encode_stream_set_mode(struct encode_stream *e, enum encode_stream_mode mode);
+TYNSEL_API void encode_stream_fini(struct encode_stream *e);
 
 #endif
 
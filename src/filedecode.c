@@ -0,0 +1,701 @@
+#include "filedecode.h"
+#include "audio.h"
+#include "reader.h"
+#include "io.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct decoded_char {
+    int status, data;
+    uint64_t offset;
+};
+
+// the state of a chunk's decoder at a block boundary
+struct mark {
+    struct streamdecode_position pos;
+    size_t count; // number of chars reported before the boundary
+};
+
+struct chunk {
+    sf_count_t first;       // first frame fed to the decoder, for warm-up
+    sf_count_t start, end;  // frames this chunk is responsible for
+    struct stream_state *sd;
+    struct filedecode_ticks ticks;
+    struct decoded_char *chars;
+    size_t count, cap;
+    struct mark *marks;     // one per block in [start, end)
+    size_t nmarks;
+    int rc;
+};
+
+struct job {
+    const char *filename;
+    struct audio_state *as;
+    int channel;
+    struct chunk *chunks;
+    size_t nchunks;
+    size_t next; // next chunk to hand out ; shared between workers
+};
+
+uint64_t filedecode_offset(struct filedecode_ticks *t, struct stream_state *sd, uint64_t first)
+{
+    unsigned tick = streamdecode_tick(sd);
+    if (tick < t->last)
+        t->wraps += (uint64_t)1 << 32;
+    t->last = tick;
+
+    return first + t->wraps + tick;
+}
+
+// decodes up to `frames' frames (or to EOF, if negative) ; when `marks' is not
+// NULL, it receives the decoder's position before each block
+static int decode_blocks(SNDFILE *sf, int channels, struct stream_state *sd,
+        sf_count_t frames, struct chunk *marks)
+{
+    double *buf = malloc(FILEDECODE_BLOCK * channels * sizeof *buf);
+    double *chan = channels == 1 ? buf : malloc(FILEDECODE_BLOCK * sizeof *chan);
+    int rc = (buf && chan) ? 0 : -1;
+
+    while (frames != 0 && !rc) {
+        sf_count_t want = (frames > 0 && frames < FILEDECODE_BLOCK) ? frames : FILEDECODE_BLOCK;
+        sf_count_t count = sf_readf_double(sf, buf, want);
+        if (count <= 0)
+            break;
+
+        if (chan != buf)
+            deinterleave(count, channels, 0, buf, chan);
+
+        if (marks) {
+            struct mark *m = &marks->marks[marks->nmarks++];
+            streamdecode_position(sd, &m->pos);
+            m->count = marks->count;
+        }
+
+        rc = streamdecode_process(sd, count, chan);
+        if (frames > 0)
+            frames -= count;
+    }
+
+    if (chan != buf)
+        free(chan);
+    free(buf);
+
+    return rc;
+}
+
+int filedecode_range(SNDFILE *sf, int channels, struct stream_state *sd, sf_count_t frames)
+{
+    return decode_blocks(sf, channels, sd, frames, NULL);
+}
+
+int filedecode_stream(SNDFILE *sf, int channels, struct stream_state *sd, size_t blocks, size_t feed)
+{
+    if (!feed)
+        feed = FILEDECODE_BLOCK;
+
+    struct reader *r;
+    if (reader_start(&r, sf, channels, 0, blocks * FILEDECODE_BLOCK))
+        return -1;
+
+    const double *samples;
+    sf_count_t count;
+    int rc = 0;
+    while (!rc && (count = reader_next(r, &samples)) > 0) {
+        for (sf_count_t i = 0; i < count && !rc; i += feed) {
+            sf_count_t n = count - i < (sf_count_t)feed ? count - i : (sf_count_t)feed;
+            rc = streamdecode_process(sd, n, &samples[i]);
+        }
+    }
+    if (count < 0)
+        rc = -1;
+
+    reader_stop(r);
+
+    return rc;
+}
+
+int filedecode_mapped(const struct pcm_view *v, int fchan, struct stream_state *sd, size_t feed)
+{
+    if (!feed)
+        feed = FILEDECODE_BLOCK;
+
+    double *buf = malloc(feed * sizeof *buf);
+    if (!buf)
+        return -1;
+
+    size_t count;
+    int rc = 0;
+    for (size_t off = 0; !rc && (count = pcm_read(v, off, fchan, feed, buf)) > 0; off += count)
+        rc = streamdecode_process(sd, count, buf);
+
+    free(buf);
+
+    return rc;
+}
+
+// replaces *sdp with a fresh decoder carrying on from a checkpoint of it
+static int rebuild(struct stream_state **sdp, struct audio_state *as, int channel,
+        void *ud, streamdecode_callback *cb, size_t len, void *buf)
+{
+    struct stream_state *fresh;
+    if (!streamdecode_save(*sdp, len, buf) || streamdecode_init(&fresh, as, ud, cb, channel))
+        return -1;
+    if (streamdecode_restore(fresh, len, buf)) {
+        streamdecode_fini(fresh);
+        return -1;
+    }
+
+    streamdecode_fini(*sdp);
+    *sdp = fresh;
+
+    return 0;
+}
+
+int filedecode_rebuilt(SNDFILE *sf, int channels, struct audio_state *as, int channel,
+        void *ud, streamdecode_callback *cb, struct stream_state **sdp, size_t feed, size_t every)
+{
+    if (!feed)
+        feed = FILEDECODE_BLOCK;
+
+    const size_t len = streamdecode_save_size(*sdp);
+    void *buf = malloc(len);
+    struct reader *r;
+    if (!buf || reader_start(&r, sf, channels, 0, FILEDECODE_READAHEAD * FILEDECODE_BLOCK)) {
+        free(buf);
+        return -1;
+    }
+
+    const double *samples;
+    sf_count_t count;
+    size_t since = 0; // frames since the last rebuild
+    int rc = 0;
+    while (!rc && (count = reader_next(r, &samples)) > 0) {
+        for (sf_count_t i = 0; i < count && !rc; ) {
+            size_t n = count - i;
+            if (n > feed)
+                n = feed;
+            if (n > every - since)
+                n = every - since;
+            rc = streamdecode_process(*sdp, n, &samples[i]);
+            i += n;
+            since += n;
+            if (!rc && since == every) {
+                rc = rebuild(sdp, as, channel, ud, cb, len, buf);
+                since = 0;
+            }
+        }
+    }
+    if (count < 0)
+        rc = -1;
+
+    reader_stop(r);
+    free(buf);
+
+    return rc;
+}
+
+// one file channel of a filedecode_channels run
+struct line {
+    struct stream_state *sd;
+    struct filedecode_ticks ticks;
+    struct decoded_char *chars; // reported during the current read block
+    size_t count, cap;
+    int rc;
+};
+
+struct lines {
+    int channels;
+    unsigned threads;           // shares the channels are split into
+    struct line *lines;
+    const double *samples;      // current read block, planar
+    sf_count_t count, stride;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned generation;        // bumped for every read block
+    unsigned pending;           // workers still busy with the current block
+    int done;
+};
+
+struct lines_worker {
+    struct lines *l;
+    unsigned share;
+    pthread_t tid;
+};
+
+// decodes one share of the channels of the current read block
+static void decode_lines(struct lines *l, unsigned share)
+{
+    for (int c = share; c < l->channels; c += l->threads) {
+        struct line *n = &l->lines[c];
+        const double *samples = &l->samples[c * l->stride];
+        for (sf_count_t i = 0; i < l->count && !n->rc; i += FILEDECODE_BLOCK) {
+            sf_count_t k = l->count - i < FILEDECODE_BLOCK ? l->count - i : FILEDECODE_BLOCK;
+            if (streamdecode_process(n->sd, k, &samples[i]))
+                n->rc = -1;
+        }
+    }
+}
+
+static void *lines_worker(void *arg)
+{
+    struct lines_worker *w = arg;
+    struct lines *l = w->l;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&l->lock);
+    for (;;) {
+        while (l->generation == seen && !l->done)
+            pthread_cond_wait(&l->cond, &l->lock);
+        if (l->done)
+            break;
+        seen = l->generation;
+        pthread_mutex_unlock(&l->lock);
+
+        decode_lines(l, w->share);
+
+        pthread_mutex_lock(&l->lock);
+        if (--l->pending == 0)
+            pthread_cond_broadcast(&l->cond);
+    }
+    pthread_mutex_unlock(&l->lock);
+
+    return NULL;
+}
+
+static int collect(void *userdata, int status, int data)
+{
+    struct chunk *c = userdata;
+    if (c->count == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 64;
+        struct decoded_char *chars = realloc(c->chars, cap * sizeof *chars);
+        if (!chars) {
+            c->rc = -1;
+            return -1;
+        }
+        c->chars = chars;
+        c->cap = cap;
+    }
+
+    c->chars[c->count++] = (struct decoded_char){
+        .status = status,
+        .data   = data,
+        .offset = filedecode_offset(&c->ticks, c->sd, c->first),
+    };
+
+    return 0;
+}
+
+static int collect_line(void *userdata, int status, int data)
+{
+    struct line *n = userdata;
+    if (n->count == n->cap) {
+        size_t cap = n->cap ? n->cap * 2 : 16;
+        struct decoded_char *chars = realloc(n->chars, cap * sizeof *chars);
+        if (!chars) {
+            n->rc = -1;
+            return -1;
+        }
+        n->chars = chars;
+        n->cap = cap;
+    }
+
+    n->chars[n->count++] = (struct decoded_char){
+        .status = status,
+        .data   = data,
+        .offset = filedecode_offset(&n->ticks, n->sd, 0),
+    };
+
+    return 0;
+}
+
+int filedecode_channels(SNDFILE *sf, int channels, struct audio_state *as, int channel,
+        unsigned threads, void *ud, filedecode_callback *cb,
+        struct streamdecode_stats *stats)
+{
+    if (threads > (unsigned)channels)
+        threads = channels;
+    if (threads < 1)
+        threads = 1;
+
+    struct lines l = {
+        .channels = channels,
+        .threads  = threads,
+        .lines    = calloc(channels, sizeof *l.lines),
+        .stride   = FILEDECODE_READAHEAD * FILEDECODE_BLOCK,
+    };
+    if (!l.lines)
+        return -1;
+
+    int rc = 0;
+    for (int c = 0; c < channels && !rc; c++) {
+        if (streamdecode_init(&l.lines[c].sd, as, &l.lines[c], collect_line, channel)) {
+            l.lines[c].sd = NULL;
+            rc = -1;
+        }
+    }
+
+    struct reader *r = NULL;
+    if (!rc && reader_start(&r, sf, channels, -1, l.stride))
+        rc = -1;
+
+    pthread_mutex_init(&l.lock, NULL);
+    pthread_cond_init(&l.cond, NULL);
+
+    // share 0 belongs to the calling thread, as do the shares of any workers
+    // that could not be started
+    struct lines_worker workers[threads];
+    unsigned started = 1;
+    while (!rc && started < threads) {
+        workers[started] = (struct lines_worker){ .l = &l, .share = started };
+        if (pthread_create(&workers[started].tid, NULL, lines_worker, &workers[started]))
+            break;
+        started++;
+    }
+
+    while (!rc && (l.count = reader_next(r, &l.samples)) > 0) {
+        pthread_mutex_lock(&l.lock);
+        l.generation++;
+        l.pending = started - 1;
+        pthread_cond_broadcast(&l.cond);
+        pthread_mutex_unlock(&l.lock);
+
+        for (unsigned s = 0; s < threads; s++)
+            if (s == 0 || s >= started)
+                decode_lines(&l, s);
+
+        pthread_mutex_lock(&l.lock);
+        while (l.pending)
+            pthread_cond_wait(&l.cond, &l.lock);
+        pthread_mutex_unlock(&l.lock);
+
+        // report in channel order, so that the output does not depend on
+        // how the threads were scheduled
+        for (int c = 0; c < channels; c++) {
+            struct line *n = &l.lines[c];
+            for (size_t i = 0; i < n->count && !rc; i++)
+                rc = cb(ud, c, n->chars[i].offset, n->chars[i].status, n->chars[i].data);
+            n->count = 0;
+            if (n->rc)
+                rc = -1;
+        }
+    }
+    if (l.count < 0)
+        rc = -1;
+
+    pthread_mutex_lock(&l.lock);
+    l.done = 1;
+    pthread_cond_broadcast(&l.cond);
+    pthread_mutex_unlock(&l.lock);
+    for (unsigned t = 1; t < started; t++)
+        pthread_join(workers[t].tid, NULL);
+
+    pthread_cond_destroy(&l.cond);
+    pthread_mutex_destroy(&l.lock);
+    if (r)
+        reader_stop(r);
+
+    for (int c = 0; c < channels; c++) {
+        struct line *n = &l.lines[c];
+        if (n->sd) {
+            struct streamdecode_stats st;
+            if (stats && !streamdecode_stats(n->sd, &st))
+                streamdecode_stats_add(stats, &st);
+            streamdecode_fini(n->sd);
+        }
+        free(n->chars);
+    }
+    free(l.lines);
+
+    return rc;
+}
+
+static SNDFILE *open_at(const struct job *j, sf_count_t frame, int *channels)
+{
+    SF_INFO sinfo = { .format = 0 };
+    SNDFILE *sf = sf_open(j->filename, SFM_READ, &sinfo);
+    if (sf && sf_seek(sf, frame, SEEK_SET) != frame) {
+        sf_close(sf);
+        return NULL;
+    }
+
+    *channels = sinfo.channels;
+    return sf;
+}
+
+static int decode_chunk(const struct job *j, struct chunk *c)
+{
+    if (streamdecode_init(&c->sd, j->as, c, collect, j->channel)) {
+        c->sd = NULL;
+        return -1;
+    }
+
+    c->marks = malloc(((c->end - c->start) / FILEDECODE_BLOCK + 1) * sizeof *c->marks);
+    int channels;
+    SNDFILE *sf = open_at(j, c->first, &channels);
+    if (!c->marks || !sf)
+        return -1;
+
+    int rc = decode_blocks(sf, channels, c->sd, c->start - c->first, NULL);
+    if (!rc)
+        rc = decode_blocks(sf, channels, c->sd, c->end - c->start, c);
+
+    sf_close(sf);
+
+    return rc ? rc : c->rc;
+}
+
+static void *worker(void *arg)
+{
+    struct job *j = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&j->next, 1, __ATOMIC_RELAXED)) < j->nchunks)
+        j->chunks[i].rc = decode_chunk(j, &j->chunks[i]);
+
+    return NULL;
+}
+
+static void retire(struct chunk *c, struct streamdecode_stats *stats)
+{
+    if (c->sd) {
+        struct streamdecode_stats st;
+        if (stats && !streamdecode_stats(c->sd, &st))
+            streamdecode_stats_add(stats, &st);
+        streamdecode_fini(c->sd);
+        c->sd = NULL;
+    }
+    free(c->chars);
+    free(c->marks);
+    c->chars = NULL;
+    c->marks = NULL;
+    c->count = c->cap = c->nmarks = 0;
+}
+
+// Runs the authoritative decoder `a' through the chunk `b' one block at a
+// time, until it arrives at a block boundary in the position that b's own
+// decoder had there. From that point the two decoders behave identically,
+// so b's decoder can take over. Returns the index of the mark where that
+// happened, or b->nmarks if `a' had to decode the whole of b.
+static size_t converge(const struct job *j, struct chunk *a, const struct chunk *b, int *rc)
+{
+    int channels;
+    SNDFILE *sf = NULL;
+    size_t m;
+    for (m = 0; m < b->nmarks && !*rc; m++) {
+        struct streamdecode_position here;
+        streamdecode_position(a->sd, &here);
+        if (!memcmp(&here, &b->marks[m].pos, sizeof here))
+            break;
+
+        sf_count_t from = b->start + m * FILEDECODE_BLOCK;
+        sf_count_t to = from + FILEDECODE_BLOCK < b->end ? from + FILEDECODE_BLOCK : b->end;
+        if (!sf && !(sf = open_at(j, from, &channels))) {
+            *rc = -1;
+            break;
+        }
+
+        *rc = decode_blocks(sf, channels, a->sd, to - from, NULL);
+        if (!*rc)
+            *rc = a->rc;
+    }
+
+    if (sf)
+        sf_close(sf);
+
+    return m;
+}
+
+int filedecode_parallel(const char *filename, struct audio_state *as, int channel,
+        unsigned threads, void *ud, filedecode_callback *cb,
+        struct streamdecode_stats *stats)
+{
+    SF_INFO sinfo = { .format = 0 };
+    SNDFILE *sf = sf_open(filename, SFM_READ, &sinfo);
+    if (!sf)
+        return -1;
+    sf_close(sf);
+
+    if (!sinfo.seekable || sinfo.frames <= 0) {
+        errno = ESPIPE;
+        return -1;
+    }
+
+    // enough overlap for the filters and energy windows to settle, and for a
+    // decoder starting from nothing to pick up the framing of a character or two
+    const double perbit = SAMPLES_PER_BIT(as);
+    const int charbits = as->start_bits + as->data_bits + as->parity_bits + as->stop_bits;
+    const sf_count_t block = FILEDECODE_BLOCK;
+    sf_count_t overlap = (sf_count_t)((4 + 3 * charbits) * perbit);
+    overlap = (overlap + block - 1) / block * block;
+
+    // a few chunks per thread, so that uneven chunks balance out
+    sf_count_t size = sinfo.frames / ((sf_count_t)threads * 4);
+    if (size < overlap * 16)
+        size = overlap * 16;
+    size = (size + block - 1) / block * block;
+
+    struct job j = {
+        .filename = filename,
+        .as       = as,
+        .channel  = channel,
+        .nchunks  = (sinfo.frames + size - 1) / size,
+        .next     = 0,
+    };
+    j.chunks = calloc(j.nchunks, sizeof *j.chunks);
+    if (!j.chunks)
+        return -1;
+
+    for (size_t i = 0; i < j.nchunks; i++) {
+        struct chunk *c = &j.chunks[i];
+        c->start = i * size;
+        c->end   = c->start + size < sinfo.frames ? c->start + size : sinfo.frames;
+        c->first = c->start > overlap ? c->start - overlap : 0;
+    }
+
+    if (threads > j.nchunks)
+        threads = j.nchunks;
+    pthread_t tids[threads];
+    unsigned started = 0;
+    while (started < threads && !pthread_create(&tids[started], NULL, worker, &j))
+        started++;
+    if (!started)
+        worker(&j);
+    for (unsigned t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+
+    int rc = 0;
+    for (size_t i = 0; i < j.nchunks; i++)
+        if (j.chunks[i].rc)
+            rc = -1;
+
+    // Stitch the chunks together. `auth' is the chunk whose decoder is
+    // authoritative at the current boundary, and `pos' the first of its
+    // characters not yet reported.
+    size_t auth = 0, pos = 0;
+    for (size_t k = 1; k < j.nchunks && !rc; k++) {
+        struct chunk *a = &j.chunks[auth], *b = &j.chunks[k];
+        size_t m = converge(&j, a, b, &rc);
+        if (m < b->nmarks) {
+            for (size_t i = pos; i < a->count; i++)
+                cb(ud, 0, a->chars[i].offset, a->chars[i].status, a->chars[i].data);
+            retire(a, stats);
+            auth = k;
+            pos = b->marks[m].count;
+        } else {
+            retire(b, stats);
+        }
+    }
+
+    struct chunk *a = &j.chunks[auth];
+    for (size_t i = pos; i < a->count && !rc; i++)
+        cb(ud, 0, a->chars[i].offset, a->chars[i].status, a->chars[i].data);
+
+    for (size_t i = 0; i < j.nchunks; i++)
+        retire(&j.chunks[i], stats);
+    free(j.chunks);
+
+    return rc;
+}
+
+// one of filedecode_bursts' decoders, which starts at frame `from'
+struct span {
+    void *ud;
+    filedecode_callback *cb;
+    struct stream_state *sd;
+    struct filedecode_ticks ticks;
+    sf_count_t from;
+};
+
+static int emit_span(void *userdata, int status, int data)
+{
+    struct span *s = userdata;
+    return s->cb(s->ud, 0, filedecode_offset(&s->ticks, s->sd, s->from), status, data);
+}
+
+int filedecode_bursts(SNDFILE *sf, int channels, struct audio_state *as, int channel,
+        size_t count, const struct burst bursts[count], void *ud, filedecode_callback *cb,
+        struct streamdecode_stats *stats)
+{
+    // the decoder needs a few bit times to settle before the carrier starts,
+    // and a character time after it ends to report the last character
+    const double perbit = SAMPLES_PER_BIT(as);
+    const int charbits = as->start_bits + as->data_bits + as->parity_bits + as->stop_bits;
+    const sf_count_t preroll = 4 * perbit, postroll = charbits * perbit;
+
+    int rc = 0;
+    size_t i = 0;
+    while (i < count && !rc) {
+        if (bursts[i].channel != channel) {
+            i++;
+            continue;
+        }
+
+        sf_count_t from = (sf_count_t)bursts[i].start > preroll ? (sf_count_t)bursts[i].start - preroll : 0;
+        from -= from % FILEDECODE_BLOCK;
+        sf_count_t to = bursts[i].end + postroll;
+        for (i++; i < count; i++) {
+            if (bursts[i].channel != channel)
+                continue;
+            if ((sf_count_t)bursts[i].start > to + preroll + FILEDECODE_BLOCK)
+                break;
+            if ((sf_count_t)bursts[i].end + postroll > to)
+                to = bursts[i].end + postroll;
+        }
+
+        struct span span = { .ud = ud, .cb = cb, .from = from };
+        if (sf_seek(sf, from, SEEK_SET) != from || streamdecode_init(&span.sd, as, &span, emit_span, channel))
+            return -1;
+
+        rc = filedecode_range(sf, channels, span.sd, to - from);
+
+        struct streamdecode_stats st;
+        if (stats && !streamdecode_stats(span.sd, &st))
+            streamdecode_stats_add(stats, &st);
+        streamdecode_fini(span.sd);
+    }
+
+    return rc;
+}
+
+int burst_scan_file(const char *filename, struct audio_state *as, size_t *frames, void *ud, burst_callback *cb)
+{
+    SF_INFO sinfo = { .format = 0 };
+    SNDFILE *sf = sf_open(filename, SFM_READ, &sinfo);
+    if (!sf)
+        return -1;
+
+    as->sample_rate = sinfo.samplerate;
+    *frames = sinfo.frames;
+
+    struct burst_scan *b;
+    if (burst_scan_init(&b, as, ud, cb)) {
+        sf_close(sf);
+        return -1;
+    }
+
+    enum { FRAMES = 4096 };
+    double *buf = malloc(FRAMES * sinfo.channels * sizeof *buf);
+    double chan[FRAMES];
+    int rc = buf ? 0 : -1;
+    sf_count_t count;
+    while (!rc && (count = sf_readf_double(sf, buf, FRAMES)) > 0) {
+        if (sinfo.channels > 1)
+            deinterleave(count, sinfo.channels, 0, buf, chan);
+        rc = burst_scan_process(b, count, sinfo.channels > 1 ? chan : buf);
+    }
+
+    if (!rc)
+        rc = burst_scan_finish(b);
+    if (sf_error(sf))
+        rc = -1;
+
+    free(buf);
+    burst_scan_fini(b);
+    sf_close(sf);
+
+    return rc;
+}
+
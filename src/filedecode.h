@@ -0,0 +1,86 @@
+#ifndef FILEDECODE_H_
+#define FILEDECODE_H_
+
+#include "streamdecode.h"
+#include "burst.h"
+
+#include <sndfile.h>
+#include <stdint.h>
+
+// Files are read in blocks of this many frames, aligned to the start of the
+// file. The parallel decoder compares decoders' positions at block
+// boundaries ; the decoders themselves give the same output however their
+// input is chunked.
+#define FILEDECODE_BLOCK 1024
+// blocks read ahead at once by filedecode_stream
+#define FILEDECODE_READAHEAD 64
+
+struct audio_state;
+struct pcm_view;
+
+// decodes up to `frames' frames (all remaining frames if `frames' < 0) of
+// the first channel of `sf' from its current position, which must be a
+// multiple of FILEDECODE_BLOCK
+int filedecode_range(SNDFILE *sf, int channels, struct stream_state *sd, sf_count_t frames);
+
+// decodes the first channel of `sf' from its start to EOF like
+// filedecode_range, but with reading and deinterleaving done on a separate
+// thread, `blocks' blocks (usually FILEDECODE_READAHEAD) ahead of the decoder ;
+// the decoder is fed at most `feed' frames at a time (FILEDECODE_BLOCK if 0)
+int filedecode_stream(SNDFILE *sf, int channels, struct stream_state *sd, size_t blocks, size_t feed);
+
+// decodes channel `fchan' of a mapped file (see io.h) from its start to
+// its end, converting `feed' frames (FILEDECODE_BLOCK if 0) at a time straight
+// out of the mapping
+int filedecode_mapped(const struct pcm_view *v, int fchan, struct stream_state *sd, size_t feed);
+
+// decodes like filedecode_stream, but every `every' frames replaces *sdp
+// with a fresh decoder made from `as', `channel', `ud' and `cb' and restored
+// from a checkpoint of the old one, to show that checkpoints lose nothing ;
+// *sdp is left pointing at the last decoder
+int filedecode_rebuilt(SNDFILE *sf, int channels, struct audio_state *as, int channel,
+        void *ud, streamdecode_callback *cb, struct stream_state **sdp, size_t feed, size_t every);
+
+// like streamdecode_callback, with the file channel the character came from
+// and the frame of the file that completed it
+typedef int filedecode_callback(void *userdata, int fchan, uint64_t offset, int status, int data);
+
+// follows a decoder's tick (see streamdecode_tick) past its wrap at 2^32
+// frames, assuming no gap between characters is that long
+struct filedecode_ticks {
+    unsigned last;
+    uint64_t wraps;
+};
+
+// from inside a decoder's callback, the frame of the file that completed the
+// character, for a decoder that started at frame `first'
+uint64_t filedecode_offset(struct filedecode_ticks *t, struct stream_state *sd, uint64_t first);
+
+// decodes every channel of `sf' from its start to EOF in one pass, with a
+// decoder per file channel and the channels shared between `threads'
+// threads ; characters are reported per read block in file channel order
+int filedecode_channels(SNDFILE *sf, int channels, struct audio_state *as, int channel,
+        unsigned threads, void *ud, filedecode_callback *cb,
+        struct streamdecode_stats *stats);
+
+// decodes `filename' in overlapping chunks on `threads' threads, reporting
+// characters and their offsets to `cb' in order, exactly as a sequential
+// filedecode_range over the whole file would, as from file channel 0 ; if
+// `stats' is not NULL the decoders' counters are added to it
+int filedecode_parallel(const char *filename, struct audio_state *as, int channel,
+        unsigned threads, void *ud, filedecode_callback *cb,
+        struct streamdecode_stats *stats);
+
+// decodes only the frames around the bursts (see burst.h) on `channel', each
+// run of nearby bursts with a fresh decoder ; offsets count from the start of
+// the file
+int filedecode_bursts(SNDFILE *sf, int channels, struct audio_state *as, int channel,
+        size_t count, const struct burst bursts[count], void *ud, filedecode_callback *cb,
+        struct streamdecode_stats *stats);
+
+// scans the first channel of a whole file, filling in as->sample_rate and the
+// file's length in *frames
+int burst_scan_file(const char *filename, struct audio_state *as, size_t *frames, void *ud, burst_callback *cb);
+
+#endif
+
@@ -2,7 +2,11 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
+// The history holds each input twice, tapcount apart, so that the last
+// tapcount inputs always lie next to each other in memory starting at
+// last_index, for the kernels that run straight through them.
 struct filter_state {
     struct filter_entry {
         int tapcount;
@@ -10,6 +14,14 @@ struct filter_state {
     } *entry;
     double *history;
     int last_index;
+    double (*get)(const struct filter_state *s);
+};
+
+static const char *kernel_names[] = {
+    [FILTER_KERNEL_DEFAULT] = "default",
+    [FILTER_KERNEL_RING]    = "ring",
+    [FILTER_KERNEL_LINEAR]  = "linear",
+    [FILTER_KERNEL_SPLIT]   = "split",
 };
 
 // Adapted from // dspUtils-10.js // Dr A.R.Collins <http://www.arc.id.au/>
@@ -66,10 +78,11 @@ struct filter_state *filter_create(enum filter_type type, double cutoff, unsigne
     struct filter_state *s = malloc(sizeof *s);
     struct filter_entry *e = s->entry = malloc(sizeof *e);
     // depends on IEEE-754-like zeros
-    s->history = calloc((e->tapcount = M), sizeof *s->history);
+    s->history = calloc(2 * M, sizeof *s->history);
     s->last_index = 0;
     e->tapcount = M;
     e->taps = H;
+    filter_set_kernel(s, FILTER_KERNEL_DEFAULT);
 
     return s;
 badparams:
@@ -78,12 +91,18 @@ badparams:
 }
 
 void filter_put(struct filter_state *s, double input) {
-    s->history[s->last_index++] = input;
-    if (s->last_index == s->entry->tapcount)
+    const int n = s->entry->tapcount;
+    s->history[s->last_index] = s->history[s->last_index + n] = input;
+    if (++s->last_index == n)
         s->last_index = 0;
 }
 
 double filter_get(struct filter_state *s) {
+    return s->get(s);
+}
+
+// walks back from the newest input, wrapping at the end of the first copy
+static double get_ring(const struct filter_state *s) {
     double acc = 0;
     int index = s->last_index;
     const struct filter_entry *e = s->entry;
@@ -95,6 +114,64 @@ double filter_get(struct filter_state *s) {
     return acc;
 }
 
+// the same sum in the same order, without the wrapping
+static double get_linear(const struct filter_state *s) {
+    const struct filter_entry *e = s->entry;
+    const double *newest = &s->history[s->last_index + e->tapcount - 1];
+    double acc = 0;
+    for (int i = 0; i < e->tapcount; ++i)
+        acc += newest[-i] * e->taps[i];
+
+    return acc;
+}
+
+// Four independent sums, which the compiler can keep in vector registers ;
+// the result is rounded differently from the other kernels. On x86-64 an
+// AVX2 version is chosen at load time where the CPU has it.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+static double get_split(const struct filter_state *s) {
+    const struct filter_entry *e = s->entry;
+    const double *oldest = &s->history[s->last_index];
+    const double *taps = e->taps;
+    const int n = e->tapcount;
+    // the taps are symmetric, so the oldest input can pair with the first tap
+    double acc[4] = { 0 };
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        for (int j = 0; j < 4; j++)
+            acc[j] += oldest[i + j] * taps[i + j];
+    for (; i < n; i++)
+        acc[0] += oldest[i] * taps[i];
+
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+void filter_set_kernel(struct filter_state *s, enum filter_kernel kernel) {
+    switch (kernel) {
+        case FILTER_KERNEL_RING:  s->get = get_ring;   break;
+        case FILTER_KERNEL_SPLIT: s->get = get_split;  break;
+        default:                  s->get = get_linear; break;
+    }
+}
+
+const char *filter_kernel_name(enum filter_kernel kernel) {
+    return (unsigned)kernel < FILTER_KERNEL_max ? kernel_names[kernel] : NULL;
+}
+
+int filter_kernel_parse(const char *name, enum filter_kernel *kernel) {
+    for (int k = 0; k < FILTER_KERNEL_max; k++) {
+        if (!strcmp(name, kernel_names[k])) {
+            *kernel = k;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
 void filter_destroy(struct filter_state *s) {
     struct filter_entry *e = s->entry;
     free(e->taps);
@@ -103,3 +180,20 @@ void filter_destroy(struct filter_state *s) {
     free(s);
 }
 
+unsigned filter_length(const struct filter_state *s) {
+    return s->entry->tapcount;
+}
+
+void filter_save(const struct filter_state *s, double history[]) {
+    const int n = s->entry->tapcount;
+    for (int i = 0, index = s->last_index; i < n; i++, index = index + 1 == n ? 0 : index + 1)
+        history[i] = s->history[index];
+}
+
+void filter_restore(struct filter_state *s, const double history[]) {
+    const int n = s->entry->tapcount;
+    for (int i = 0; i < n; i++)
+        s->history[i] = s->history[i + n] = history[i];
+    s->last_index = 0;
+}
+
@@ -1,6 +1,8 @@
 #ifndef FILTERS_H_
 #define FILTERS_H_
 
+#include "tynsel_api.h"
+
 enum filter_type {
 	FILTER_TYPE_invalid,
 
@@ -10,12 +12,37 @@ enum filter_type {
 	FILTER_TYPE_max
 };
 
+// How filter_get computes its dot product. The kernels differ only in speed,
+// except that SPLIT rounds differently, and so can flip a decision that was
+// balanced on a knife edge.
+enum filter_kernel {
+	FILTER_KERNEL_DEFAULT,  // LINEAR
+
+	FILTER_KERNEL_RING,     // the history indexed as a ring, the reference
+	FILTER_KERNEL_LINEAR,   // the same sum, straight through a mirrored history
+	FILTER_KERNEL_SPLIT,    // four interleaved partial sums, for SIMD
+
+	FILTER_KERNEL_max
+};
+
 struct filter_state;
 
-struct filter_state *filter_create(enum filter_type type, double cutoff, unsigned length, unsigned sample_rate, double attenuation);
-void filter_put(struct filter_state *s, double input);
-double filter_get(struct filter_state *s);
-void filter_destroy(struct filter_state *s);
+TYNSEL_API struct filter_state *filter_create(enum filter_type type, double cutoff, unsigned length, unsigned sample_rate, double attenuation);
+TYNSEL_API void filter_put(struct filter_state *s, double input);
+TYNSEL_API double filter_get(struct filter_state *s);
+TYNSEL_API void filter_destroy(struct filter_state *s);
+
+TYNSEL_API void filter_set_kernel(struct filter_state *s, enum filter_kernel kernel);
+// names are "default", "ring", "linear" and "split"
+TYNSEL_API const char *filter_kernel_name(enum filter_kernel kernel);
+TYNSEL_API int filter_kernel_parse(const char *name, enum filter_kernel *kernel);
+
+// the number of past inputs the filter remembers
+TYNSEL_API unsigned filter_length(const struct filter_state *s);
+// copies those inputs out, oldest first, or back in ; a filter restored from
+// another of the same design gives the same outputs as the original would
+TYNSEL_API void filter_save(const struct filter_state *s, double history[]);
+TYNSEL_API void filter_restore(struct filter_state *s, const double history[]);
 
 #endif
 
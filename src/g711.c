@@ -0,0 +1,105 @@
+#include "g711.h"
+
+#include <pthread.h>
+
+// after the public-domain Sun Microsystems reference implementation
+
+#define SIGN_BIT   0x80
+#define QUANT_MASK 0x0f
+#define SEG_SHIFT  4
+#define SEG_MASK   0x70
+#define BIAS       0x84
+#define CLIP       8159
+
+static const int16_t seg_uend[8] = { 0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff, 0x1fff };
+static const int16_t seg_aend[8] = { 0x1f, 0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff };
+
+static double tables[2][256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static int ulaw_to_linear(unsigned char u)
+{
+    u = ~u;
+    int t = ((u & QUANT_MASK) << 3) + BIAS;
+    t <<= (u & SEG_MASK) >> SEG_SHIFT;
+    return (u & SIGN_BIT) ? BIAS - t : t - BIAS;
+}
+
+static int alaw_to_linear(unsigned char a)
+{
+    a ^= 0x55;
+    int t = (a & QUANT_MASK) << 4;
+    int seg = (a & SEG_MASK) >> SEG_SHIFT;
+    switch (seg) {
+        case 0:  t += 8;                      break;
+        case 1:  t += 0x108;                  break;
+        default: t += 0x108; t <<= seg - 1;   break;
+    }
+    return (a & SIGN_BIT) ? t : -t;
+}
+
+static void build_tables(void)
+{
+    for (int i = 0; i < 256; i++) {
+        tables[G711_ULAW][i] = ulaw_to_linear(i) / 32768.;
+        tables[G711_ALAW][i] = alaw_to_linear(i) / 32768.;
+    }
+}
+
+const double *g711_table(enum g711_law law)
+{
+    pthread_once(&tables_once, build_tables);
+    return tables[law];
+}
+
+static int segment(int val, const int16_t end[8])
+{
+    int seg = 0;
+    while (seg < 8 && val > end[seg])
+        seg++;
+    return seg;
+}
+
+static unsigned char linear_to_ulaw(int pcm)
+{
+    int mask;
+    pcm >>= 2;
+    if (pcm < 0) {
+        pcm = -pcm;
+        mask = 0x7f;
+    } else {
+        mask = 0xff;
+    }
+    if (pcm > CLIP)
+        pcm = CLIP;
+    pcm += BIAS >> 2;
+
+    int seg = segment(pcm, seg_uend);
+    if (seg >= 8)
+        return 0x7f ^ mask;
+    return ((seg << 4) | ((pcm >> (seg + 1)) & QUANT_MASK)) ^ mask;
+}
+
+static unsigned char linear_to_alaw(int pcm)
+{
+    int mask;
+    pcm >>= 3;
+    if (pcm >= 0) {
+        mask = 0xd5;
+    } else {
+        mask = 0x55;
+        pcm = -pcm - 1;
+    }
+
+    int seg = segment(pcm, seg_aend);
+    if (seg >= 8)
+        return 0x7f ^ mask;
+    int aval = seg << SEG_SHIFT;
+    aval |= (pcm >> (seg < 2 ? 1 : seg)) & QUANT_MASK;
+    return aval ^ mask;
+}
+
+unsigned char g711_encode(enum g711_law law, int16_t sample)
+{
+    return law == G711_ALAW ? linear_to_alaw(sample) : linear_to_ulaw(sample);
+}
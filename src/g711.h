@@ -0,0 +1,27 @@
+#ifndef G711_H_
+#define G711_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// G.711 companding, as RTP carries it in payload types 0 (PCMU) and 8 (PCMA)
+enum g711_law {
+    G711_ULAW,
+    G711_ALAW,
+};
+
+// the value of each of the 256 codes of `law', as doubles in [-1, 1) scaled
+// as libsndfile scales 16-bit samples ; built on first use
+const double *g711_table(enum g711_law law);
+
+// decodes `count' codes by table lookup
+static inline void g711_decode(const double table[256], size_t count,
+        const unsigned char in[count], double out[count])
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = table[in[i]];
+}
+
+unsigned char g711_encode(enum g711_law law, int16_t sample);
+
+#endif
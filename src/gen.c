@@ -20,21 +20,99 @@
  * IN THE SOFTWARE.
  */
 
-#define _XOPEN_SOURCE 600
+#define _XOPEN_SOURCE 700
 #include "encode.h"
 #include "common.h"
+#include "io.h"
 
+#include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <sndfile.h>
 
-static int parse_opts(struct encode_state *s, int argc, char *argv[], const char **filename)
+// samples are collected and written this many at a time
+#define OUTPUT_BLOCK 4096
+// payload bytes read from a file at a time
+#define PAYLOAD_BLOCK 4096
+// In a multichannel render each line has this many bit times of mark carrier
+// ahead of its text, and at least this many after it
+#define LEAD_BITS 20
+#define TAIL_BITS 20
+#define MAX_LINES 256
+
+struct output {
+    SNDFILE *sf;
+    size_t count;
+    double buf[OUTPUT_BLOCK];
+};
+
+struct gen_opts {
+    const char *filename;   // output file, or directory in batch mode
+    const char *input;      // payload file, instead of bytes on the command line
+    const char *batch;      // file listing payload files, one per line
+    unsigned threads;       // workers in batch mode
+    enum pcm_format format;
+    int raw;
+
+    // a multichannel render, when lines is nonzero
+    unsigned lines;
+    size_t chars;           // of text per line
+    size_t spread;          // lines start up to this many frames after the index
+    double min_gain;        // gains are chosen between this and the gain given
+    unsigned seed;
+    const char *manifest;   // where to list the characters sent
+};
+
+// one channel of a multichannel render
+struct line {
+    struct encode_stream *e;
+    size_t start;           // frame at which its carrier begins
+    size_t queue_at;        // frames after that, at which its text is queued
+    int queued;
+    double gain;
+    size_t count;
+    unsigned char *text;
+};
+
+struct multi {
+    unsigned lines;
+    struct line *line;
+    size_t frames;          // in the whole output
+    // a block of every line, interleaved ; the workers render into one while
+    // the other is written out
+    double *buf[2];
+    pthread_barrier_t done; // sized for the workers once they have all started
+    // the workers hold off until told whether every one of them started :
+    // 1 to render, -1 to give up
+    pthread_mutex_t lock;
+    pthread_cond_t go;
+    int state;
+};
+
+struct multi_worker {
+    struct multi *m;
+    unsigned first, last;   // the group of lines it renders
+};
+
+struct batch {
+    const struct encode_state *tmpl;
+    const struct gen_opts *opts;
+    char **inputs;
+    size_t count;
+    size_t next;            // next input to hand out ; shared between workers
+    size_t failed;
+};
+
+static int parse_opts(struct encode_state *s, int argc, char *argv[], struct gen_opts *o)
 {
     int ch;
-    while ((ch = getopt(argc, argv, "C:G:S:T:P:D:s:I:L:o:" "vV")) != -1) {
+    while ((ch = getopt(argc, argv, "C:G:S:T:P:D:s:I:L:o:f:i:b:j:p:N:n:W:g:r:M:" "vVR")) != -1) {
         switch (ch) {
             case 'C': s->channel             = strtol(optarg, NULL, 0); break;
             case 'G': s->gain                = strtod(optarg, NULL);    break;
@@ -45,10 +123,35 @@ static int parse_opts(struct encode_state *s, int argc, char *argv[], const char
             case 's': s->audio.sample_rate   = strtol(optarg, NULL, 0); break;
             case 'I': s->index               = strtol(optarg, NULL, 0); break;
             case 'L': s->length              = strtol(optarg, NULL, 0); break;
-            case 'o': *filename              = optarg;                  break;
+            case 'o': o->filename            = optarg;                  break;
+            case 'i': o->input               = optarg;                  break;
+            case 'b': o->batch               = optarg;                  break;
+            case 'j': o->threads             = strtol(optarg, NULL, 0); break;
+            case 'N': o->lines               = strtol(optarg, NULL, 0); break;
+            case 'n': o->chars               = strtoul(optarg, NULL, 0); break;
+            case 'W': o->spread              = strtoul(optarg, NULL, 0); break;
+            case 'g': o->min_gain            = strtod(optarg, NULL);    break;
+            case 'r': o->seed                = strtoul(optarg, NULL, 0); break;
+            case 'M': o->manifest            = optarg;                  break;
+            case 'f':
+                if (pcm_format_parse(optarg, &o->format)) {
+                    fprintf(stderr, "Unknown sample format `%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'p': {
+                enum fsk_profile profile;
+                if (fsk_profile_parse(optarg, &profile)) {
+                    fprintf(stderr, "Unknown modem profile `%s'\n", optarg);
+                    return -1;
+                }
+                audio_set_profile(&s->audio, profile);
+                break;
+            }
 
             case 'v': s->verbosity++;                                   break;
             case 'V': s->bitamp = 1;                                    break;
+            case 'R': o->raw = 1;                                       break;
             default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
         }
     }
@@ -56,10 +159,38 @@ static int parse_opts(struct encode_state *s, int argc, char *argv[], const char
     return 0;
 }
 
+static int flush_output(struct output *o)
+{
+    sf_count_t written = sf_write_double(o->sf, o->buf, o->count);
+    int rc = written == (sf_count_t)o->count ? 0 : -1;
+    o->count = 0;
+    return rc;
+}
+
 static int sample_callback(struct audio_state *a, size_t count, double samples[count], void *userdata)
 {
     (void)a;
-    return sf_write_double(userdata, samples, count);
+    struct output *o = userdata;
+    for (size_t i = 0; i < count; i++) {
+        o->buf[o->count++] = samples[i];
+        if (o->count == OUTPUT_BLOCK && flush_output(o))
+            return -1;
+    }
+
+    return count;
+}
+
+static int put_silence(struct encode_state *s, size_t count)
+{
+    static double zeros[OUTPUT_BLOCK];
+    while (count > 0) {
+        size_t n = count < OUTPUT_BLOCK ? count : OUTPUT_BLOCK;
+        if (s->cb.put_samples(&s->audio, n, zeros, s->cb.userdata) < 0)
+            return -1;
+        count -= n;
+    }
+
+    return 0;
 }
 
 static int parse_number(const char *in, char **next, int base)
@@ -75,13 +206,466 @@ static int parse_number(const char *in, char **next, int base)
     return strtol(in, next, base);
 }
 
+static int open_output(struct output *out, const struct gen_opts *o, const char *filename, unsigned rate, int channels)
+{
+    SF_INFO sinfo = {
+        .samplerate = rate,
+        .channels   = channels,
+        .format     = (o->raw ? SF_FORMAT_RAW : SF_FORMAT_WAV) | pcm_format_sf(o->format),
+    };
+    if (!strcmp(filename, "-")) {
+        // libsndfile cannot write a WAV header to a pipe, since it would
+        // need to seek back to fill in the lengths ; write one that
+        // leaves them open, followed by raw samples
+        if (!o->raw && lseek(STDOUT_FILENO, 0, SEEK_CUR) < 0) {
+            if (wav_stream_header(STDOUT_FILENO, sinfo.samplerate, channels, o->format)) {
+                fprintf(stderr, "Failed to write to stdout : %s\n", strerror(errno));
+                return -1;
+            }
+            sinfo.format = SF_FORMAT_RAW | pcm_format_sf(o->format);
+        }
+        out->sf = sf_open_fd(STDOUT_FILENO, SFM_WRITE, &sinfo, 0);
+    } else {
+        out->sf = sf_open(filename, SFM_WRITE, &sinfo);
+    }
+    if (!out->sf) {
+        fprintf(stderr, "Failed to open `%s' : %s\n", filename, sf_strerror(NULL));
+        return -1;
+    }
+
+    return 0;
+}
+
+// writes one output file, with its payload read from `in' if that is not
+// NULL, or else taken from `bytes'
+static int render(const struct encode_state *tmpl, const struct gen_opts *o,
+        const char *filename, FILE *in, size_t count, unsigned bytes[count])
+{
+    struct encode_state _s = *tmpl, *s = &_s;
+    struct output *out = s->cb.userdata = calloc(1, sizeof *out);
+    if (!out || open_output(out, o, filename, s->audio.sample_rate, 1)) {
+        free(out);
+        return -1;
+    }
+
+    int rc = 0;
+    size_t samples = 0;
+    if (s->index > 0)
+        rc = put_silence(s, s->index);
+    if (!rc)
+        rc = encode_carrier(s, 20);
+    // the payload has always started from a fresh phase rather than the
+    // carrier's ; only its own chunks join up
+    s->phase = (struct encode_phase){ .last_quadrant = 0 };
+
+    if (!rc && in) {
+        unsigned char buf[PAYLOAD_BLOCK];
+        unsigned chunk[PAYLOAD_BLOCK];
+        size_t n;
+        while (!rc && (n = fread(buf, 1, sizeof buf, in)) > 0) {
+            for (size_t i = 0; i < n; i++)
+                chunk[i] = buf[i];
+            int k = encode_bytes(s, n, chunk);
+            if (k < 0)
+                rc = -1;
+            else
+                samples += k;
+        }
+        if (ferror(in)) {
+            fprintf(stderr, "Error while reading payload for `%s' : %s\n", filename, strerror(errno));
+            rc = -1;
+        }
+    } else if (!rc) {
+        int k = encode_bytes(s, count, bytes);
+        if (k < 0)
+            rc = -1;
+        else
+            samples = k;
+    }
+    if (rc)
+        fprintf(stderr, "Error while encoding `%s' : %s\n", filename, strerror(errno));
+
+    if (!rc && s->index >= 0 && samples + s->index < (size_t)s->length)
+        rc = put_silence(s, s->length - samples - s->index);
+
+    if (flush_output(out) || sf_error(out->sf)) {
+        fprintf(stderr, "Failed to write `%s' : %s\n", filename, sf_strerror(out->sf));
+        rc = -1;
+    }
+
+    sf_close(out->sf);
+    free(out);
+
+    return rc;
+}
+
+static const char *base_name(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    return base ? base + 1 : path;
+}
+
+static int compare_base_names(const void *a, const void *b)
+{
+    return strcmp(base_name(*(char *const *)a), base_name(*(char *const *)b));
+}
+
+static void *batch_worker(void *arg)
+{
+    struct batch *b = arg;
+    const struct gen_opts *o = b->opts;
+    const char *ext = o->raw ? ".raw" : ".wav";
+    size_t i;
+    while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->count) {
+        const char *input = b->inputs[i];
+        const char *base = base_name(input);
+
+        char output[strlen(o->filename) + 1 + strlen(base) + strlen(ext) + 1];
+        snprintf(output, sizeof output, "%s/%s%s", o->filename, base, ext);
+
+        FILE *in = fopen(input, "rb");
+        int rc = -1;
+        if (!in)
+            fprintf(stderr, "Failed to open `%s' : %s\n", input, strerror(errno));
+        else
+            rc = render(b->tmpl, o, output, in, 0, NULL);
+        if (in)
+            fclose(in);
+        if (rc)
+            __atomic_fetch_add(&b->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+// renders every payload file named in o->batch into o->filename, a directory,
+// each as its base name with the extension added ; the workers run at once,
+// so a list in which two files share a base name is refused before anything
+// is written
+static int run_batch(const struct encode_state *tmpl, const struct gen_opts *o)
+{
+    FILE *list = strcmp(o->batch, "-") ? fopen(o->batch, "r") : stdin;
+    if (!list) {
+        fprintf(stderr, "Failed to open `%s' : %s\n", o->batch, strerror(errno));
+        return -1;
+    }
+
+    struct batch b = { .tmpl = tmpl, .opts = o, .count = 0 };
+    size_t cap = 0;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t n;
+    int rc = 0;
+    while (!rc && (n = getline(&line, &len, list)) >= 0) {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+            line[--n] = '\0';
+        if (n == 0)
+            continue;
+        if (b.count == cap) {
+            cap = cap ? cap * 2 : 64;
+            char **inputs = realloc(b.inputs, cap * sizeof *inputs);
+            if (!inputs) {
+                rc = -1;
+                break;
+            }
+            b.inputs = inputs;
+        }
+        if (!(b.inputs[b.count] = strdup(line)))
+            rc = -1;
+        else
+            b.count++;
+    }
+    free(line);
+    if (list != stdin)
+        fclose(list);
+
+    char **sorted = rc || !b.count ? NULL : malloc(b.count * sizeof *sorted);
+    if (sorted) {
+        memcpy(sorted, b.inputs, b.count * sizeof *sorted);
+        qsort(sorted, b.count, sizeof *sorted, compare_base_names);
+        for (size_t i = 1; i < b.count && !rc; i++) {
+            if (!compare_base_names(&sorted[i - 1], &sorted[i])) {
+                fprintf(stderr, "`%s' and `%s' would both be rendered to `%s/%s%s'\n",
+                        sorted[i - 1], sorted[i], o->filename, base_name(sorted[i]),
+                        o->raw ? ".raw" : ".wav");
+                rc = -1;
+            }
+        }
+        free(sorted);
+    } else if (b.count) {
+        rc = -1;
+    }
+
+    unsigned threads = o->threads;
+    if (threads > b.count)
+        threads = b.count;
+    pthread_t tids[threads ? threads : 1];
+    unsigned started = 0;
+    while (!rc && started < threads && !pthread_create(&tids[started], NULL, batch_worker, &b))
+        started++;
+    if (!rc && !started)
+        batch_worker(&b);
+    for (unsigned t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+
+    if (b.failed)
+        fprintf(stderr, "Failed to render %zu of %zu payloads\n", b.failed, b.count);
+
+    for (size_t i = 0; i < b.count; i++)
+        free(b.inputs[i]);
+    free(b.inputs);
+
+    return rc || b.failed ? -1 : 0;
+}
+
+// the frame at which bit `k' of an encode_stream begins, counting from its
+// first ; encode_stream_fill starts each bit on the frame nearest its time
+static size_t bit_frame(double perbit, size_t k)
+{
+    return k ? (size_t)floor(k * perbit - .5) + 1 : 0;
+}
+
+// spreads the seeds of neighbouring lines apart, since rand_r's sequences
+// from nearby seeds start out alike
+static unsigned line_seed(unsigned seed, unsigned line)
+{
+    uint32_t x = seed * 2654435761u ^ (line + 0x9e3779b9u);
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+// fills frames [pos, pos + count) of `l' into every `stride'th of `out'
+static void render_line(struct line *l, size_t pos, size_t count, double *out, unsigned stride)
+{
+    double block[OUTPUT_BLOCK];
+    size_t i = 0;
+    for (; i < count && pos + i < l->start; i++)
+        block[i] = 0;
+
+    while (i < count) {
+        const size_t at = pos + i - l->start;
+        size_t n = count - i;
+        if (!l->queued && at == l->queue_at) {
+            // queued a little before its bit begins, so that it starts there
+            encode_stream_queue(l->e, l->count, l->text);
+            l->queued = 1;
+        } else if (!l->queued && at + n > l->queue_at) {
+            n = l->queue_at - at;
+        }
+        encode_stream_fill(l->e, n, &block[i]);
+        i += n;
+    }
+
+    for (i = 0; i < count; i++)
+        out[i * stride] = block[i];
+}
+
+static void *multi_worker(void *arg)
+{
+    struct multi_worker *w = arg;
+    struct multi *m = w->m;
+
+    pthread_mutex_lock(&m->lock);
+    while (!m->state)
+        pthread_cond_wait(&m->go, &m->lock);
+    const int render = m->state > 0;
+    pthread_mutex_unlock(&m->lock);
+    if (!render)
+        return NULL;
+
+    for (size_t pos = 0, b = 0; pos < m->frames; pos += OUTPUT_BLOCK, b++) {
+        const size_t n = m->frames - pos < OUTPUT_BLOCK ? m->frames - pos : OUTPUT_BLOCK;
+        for (unsigned l = w->first; l < w->last; l++)
+            render_line(&m->line[l], pos, n, m->buf[b & 1] + l, m->lines);
+        pthread_barrier_wait(&m->done);
+    }
+
+    return NULL;
+}
+
+// lists every character that is complete within the output, with the frames
+// at which it starts and ends
+static int write_manifest(const char *filename, const struct encode_state *s, const struct multi *m)
+{
+    FILE *f = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Failed to open `%s' : %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    const struct audio_state *a = &s->audio;
+    const double perbit = SAMPLES_PER_BIT(a);
+    const int charbits = a->start_bits + a->data_bits + a->parity_bits + a->stop_bits;
+
+    fprintf(f, "# tynsel manifest 1\n");
+    fprintf(f, "# rate %u baud %u channel %u lines %u frames %zu\n",
+            a->sample_rate, a->baud_rate, s->channel, m->lines, m->frames);
+    for (unsigned l = 0; l < m->lines; l++)
+        fprintf(f, "# line %u : start %zu, gain %.4f, %zu characters\n",
+                l, m->line[l].start, m->line[l].gain, m->line[l].count);
+    fprintf(f, "# line start end data\n");
+    for (unsigned l = 0; l < m->lines; l++) {
+        const struct line *line = &m->line[l];
+        for (size_t c = 0; c < line->count; c++) {
+            const size_t start = line->start + bit_frame(perbit, LEAD_BITS + c * charbits);
+            const size_t end   = line->start + bit_frame(perbit, LEAD_BITS + (c + 1) * charbits);
+            if (end > m->frames)
+                break;
+            fprintf(f, "%u %zu %zu %u\n", l, start, end, line->text[c]);
+        }
+    }
+
+    int rc = ferror(f) ? -1 : 0;
+    if (f != stdout ? fclose(f) : fflush(f))
+        rc = -1;
+    if (rc)
+        fprintf(stderr, "Failed to write `%s' : %s\n", filename, strerror(errno));
+
+    return rc;
+}
+
+// Renders o->lines independent lines, one to a channel, each with its own
+// random text, start and gain. Lines are rendered a block at a time by
+// groups across threads, and written out as the next block is rendered.
+static int run_multi(const struct encode_state *tmpl, const struct gen_opts *o)
+{
+    const struct audio_state *a = &tmpl->audio;
+    const double perbit = SAMPLES_PER_BIT(a);
+    const int charbits = a->start_bits + a->data_bits + a->parity_bits + a->stop_bits;
+
+    struct multi m = {
+        .lines = o->lines,
+        .lock  = PTHREAD_MUTEX_INITIALIZER,
+        .go    = PTHREAD_COND_INITIALIZER,
+    };
+    m.line = calloc(m.lines, sizeof *m.line);
+    m.buf[0] = malloc(OUTPUT_BLOCK * m.lines * sizeof *m.buf[0]);
+    m.buf[1] = malloc(OUTPUT_BLOCK * m.lines * sizeof *m.buf[1]);
+    int rc = m.line && m.buf[0] && m.buf[1] ? 0 : -1;
+
+    // each line draws from its own sequence, so that what it holds does not
+    // depend on the number of lines or threads
+    for (unsigned l = 0; l < m.lines && !rc; l++) {
+        struct line *line = &m.line[l];
+        unsigned seed = line_seed(o->seed, l);
+        line->start    = tmpl->index + (o->spread ? rand_r(&seed) % o->spread : 0);
+        line->gain     = o->min_gain + (tmpl->gain - o->min_gain) * rand_r(&seed) / RAND_MAX;
+        line->queue_at = bit_frame(perbit, LEAD_BITS) - 1;
+        line->count    = o->chars;
+        if (!(line->text = malloc(line->count ? line->count : 1))) {
+            rc = -1;
+            break;
+        }
+        for (size_t c = 0; c < line->count; c++)
+            line->text[c] = rand_r(&seed) & ((1u << a->data_bits) - 1);
+
+        struct encode_state s = *tmpl;
+        s.gain = line->gain;
+        if (encode_stream_init(&line->e, &s, line->count ? line->count : 1)) {
+            rc = -1;
+            break;
+        }
+
+        const size_t end = line->start + bit_frame(perbit, LEAD_BITS + line->count * charbits + TAIL_BITS);
+        if (end > m.frames)
+            m.frames = end;
+    }
+    if (tmpl->length > 0)
+        m.frames = tmpl->length;
+    if (rc)
+        fprintf(stderr, "Failed to set up %u lines : %s\n", m.lines, strerror(errno));
+
+    if (!rc && o->manifest)
+        rc = write_manifest(o->manifest, tmpl, &m);
+
+    struct output out = { .sf = NULL };
+    if (!rc)
+        rc = open_output(&out, o, o->filename, a->sample_rate, m.lines);
+
+    unsigned threads = o->threads < m.lines ? o->threads : m.lines;
+    pthread_t tids[threads];
+    struct multi_worker workers[threads];
+    unsigned started = 0;
+    int err = 0;
+    for (; !rc && started < threads; started++) {
+        workers[started] = (struct multi_worker){
+            .m     = &m,
+            .first = (uint64_t)m.lines *  started      / threads,
+            .last  = (uint64_t)m.lines * (started + 1) / threads,
+        };
+        if ((err = pthread_create(&tids[started], NULL, multi_worker, &workers[started]))) {
+            fprintf(stderr, "Failed to start render threads : %s\n", strerror(err));
+            rc = -1;
+            break;
+        }
+    }
+    if (!rc && (err = pthread_barrier_init(&m.done, NULL, threads + 1))) {
+        fprintf(stderr, "Failed to set up render threads : %s\n", strerror(err));
+        rc = -1;
+    }
+    // the workers that did start are sent away if anything failed
+    pthread_mutex_lock(&m.lock);
+    m.state = rc ? -1 : 1;
+    pthread_cond_broadcast(&m.go);
+    pthread_mutex_unlock(&m.lock);
+
+    // once a write fails the rest are skipped, but the workers are still
+    // waited for block by block, so that they finish
+    for (size_t pos = 0, b = 0; m.state > 0 && pos < m.frames; pos += OUTPUT_BLOCK, b++) {
+        const size_t n = m.frames - pos < OUTPUT_BLOCK ? m.frames - pos : OUTPUT_BLOCK;
+        pthread_barrier_wait(&m.done);
+        if (!rc && sf_writef_double(out.sf, m.buf[b & 1], n) != (sf_count_t)n) {
+            fprintf(stderr, "Failed to write `%s' : %s\n", o->filename, sf_strerror(out.sf));
+            rc = -1;
+        }
+    }
+    for (unsigned t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+    if (m.state > 0)
+        pthread_barrier_destroy(&m.done);
+
+    if (out.sf) {
+        sf_close(out.sf);
+        // what was written is missing lines or blocks
+        if (rc && strcmp(o->filename, "-"))
+            unlink(o->filename);
+    }
+    for (unsigned l = 0; m.line && l < m.lines; l++) {
+        if (m.line[l].e)
+            encode_stream_fini(m.line[l].e);
+        free(m.line[l].text);
+    }
+    free(m.line);
+    free(m.buf[1]);
+    free(m.buf[0]);
+
+    return rc;
+}
+
 int main(int argc, char* argv[])
 {
-    const char *output_file = NULL;
+    struct gen_opts opts = {
+        .filename = NULL,
+        .input    = NULL,
+        .batch    = NULL,
+        .threads  = 0,
+        .format   = PCM_S16,
+        .raw      = 0,
+        .lines    = 0,
+        .chars    = 100,
+        .spread   = 0,
+        .min_gain = -1,
+        .seed     = 1,
+        .manifest = NULL,
+    };
     struct encode_state _s = {
         .audio = {
             .sample_rate = 44100,
-            .baud_rate   = 300, // TODO make baud_rate configurable
+            .baud_rate   = 300,
             .start_bits  = 1,
             .data_bits   = 8,
             .parity_bits = 0,
@@ -94,11 +678,11 @@ int main(int argc, char* argv[])
         .cb.put_samples = sample_callback,
     }, *s = &_s;
 
-    int rc = parse_opts(s, argc, argv, &output_file);
+    int rc = parse_opts(s, argc, argv, &opts);
     if (rc)
         return rc;
-    if (!output_file) {
-        fprintf(stderr, "No file specified to generate -- use `-o'\n");
+    if (!opts.filename) {
+        fprintf(stderr, "No file specified to generate -- use `-o' (`-o -' for stdout)\n");
         return -1;
     }
 
@@ -107,47 +691,58 @@ int main(int argc, char* argv[])
         return -1;
     }
 
-    SNDFILE *sf;
-    {
-        SF_INFO sinfo = {
-            .samplerate = s->audio.sample_rate,
-            .channels   = 1,
-            .format     = SF_FORMAT_WAV | SF_FORMAT_PCM_16,
-        };
-        sf = s->cb.userdata = sf_open(output_file, SFM_WRITE, &sinfo);
-        if (!sf) {
-            fprintf(stderr, "Failed to open `%s' : %s\n", output_file, strerror(errno));
-            exit(EXIT_FAILURE);
+    if (opts.lines) {
+        if (opts.lines > MAX_LINES) {
+            fprintf(stderr, "Too many lines (%u) ; at most %d\n", opts.lines, MAX_LINES);
+            return -1;
+        }
+        if (opts.min_gain < 0 || opts.min_gain > s->gain)
+            opts.min_gain = s->gain;
+        if (!opts.threads) {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            opts.threads = n > 0 ? n : 1;
+        }
+        return run_multi(s, &opts) ? EXIT_FAILURE : 0;
+    }
+
+    if (opts.batch) {
+        if (!opts.threads) {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            opts.threads = n > 0 ? n : 1;
+        }
+        return run_batch(s, &opts) ? EXIT_FAILURE : 0;
+    }
+
+    if (opts.input) {
+        FILE *in = strcmp(opts.input, "-") ? fopen(opts.input, "rb") : stdin;
+        if (!in) {
+            fprintf(stderr, "Failed to open `%s' : %s\n", opts.input, strerror(errno));
+            return -1;
         }
+        rc = render(s, &opts, opts.filename, in, 0, NULL);
+        if (in != stdin)
+            fclose(in);
+
+        return rc;
     }
 
     size_t byte_count = argc - optind;
-    unsigned bytes[byte_count];
+    unsigned *bytes = malloc((byte_count ? byte_count : 1) * sizeof *bytes);
+    if (!bytes)
+        return -1;
     for (unsigned byte_index = 0; byte_index < byte_count; byte_index++) {
         char *next = NULL;
         char *thing = argv[byte_index + optind];
         bytes[byte_index] = parse_number(thing, &next, 0);
         if (next == thing) {
             fprintf(stderr, "Error parsing argument at index %d, `%s'\n", optind, thing);
+            free(bytes);
             return -1;
         }
     }
 
-    double zero = 0.;
-    for (int i = 0; i < s->index; i++)
-        // TODO put more samples at once
-        s->cb.put_samples(&s->audio, 1, &zero, s->cb.userdata);
-
-    encode_carrier(s, 20);
+    rc = render(s, &opts, opts.filename, NULL, byte_count, bytes);
+    free(bytes);
 
-    int samples = encode_bytes(s, byte_count, bytes);
-    if (samples < 0)
-        fprintf(stderr, "Error while encoding %zd bytes : %s\n", byte_count, strerror(errno));
-
-    for (int i = samples + s->index; i < s->length; i++)
-        s->cb.put_samples(&s->audio, 1, &zero, s->cb.userdata);
-
-    sf_close(sf);
-
-    return 0;
+    return rc;
 }
@@ -0,0 +1,64 @@
+#include "hist.h"
+
+static unsigned bucket_of(unsigned long long v)
+{
+    if (v < HIST_SUB)
+        return v;
+
+    int msb = 63 - __builtin_clzll(v);
+    // the HIST_SUB_BITS bits under the leading one pick the sub-bucket
+    unsigned sub = (v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+static unsigned long long bucket_top(unsigned b)
+{
+    if (b < HIST_SUB)
+        return b;
+
+    unsigned msb = b / HIST_SUB + HIST_SUB_BITS - 1;
+    unsigned long long base = 1ull << msb;
+    unsigned long long step = base / HIST_SUB;
+    return base + (b % HIST_SUB + 1) * step - 1;
+}
+
+void hist_add(struct hist *h, unsigned long long v)
+{
+    __atomic_fetch_add(&h->bucket[bucket_of(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    if (v > __atomic_load_n(&h->max, __ATOMIC_RELAXED))
+        __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+void hist_snapshot(const struct hist *h, struct hist *out)
+{
+    out->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    out->max   = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    for (unsigned b = 0; b < HIST_BUCKETS; b++)
+        out->bucket[b] = __atomic_load_n(&h->bucket[b], __ATOMIC_RELAXED);
+}
+
+unsigned long long hist_percentile(const struct hist *h, double p)
+{
+    unsigned long long total = 0;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++)
+        total += h->bucket[b];
+    if (!total)
+        return 0;
+
+    unsigned long long rank = total * p / 100;
+    if (rank < 1)
+        rank = 1;
+
+    unsigned long long seen = 0;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->bucket[b];
+        if (seen >= rank) {
+            unsigned long long top = bucket_top(b);
+            return top < h->max ? top : h->max;
+        }
+    }
+
+    return h->max;
+}
+
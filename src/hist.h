@@ -0,0 +1,26 @@
+#ifndef HIST_H_
+#define HIST_H_
+
+// A fixed-size histogram of durations or other unsigned quantities, for
+// percentiles on a hot path without allocating. Buckets are HIST_SUB to a
+// power of two, so a percentile is exact to within 1 / HIST_SUB of its value.
+// One thread may add while others take snapshots.
+#define HIST_SUB_BITS 2
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+struct hist {
+    unsigned long long count, max;
+    unsigned long long bucket[HIST_BUCKETS];
+};
+
+void hist_add(struct hist *h, unsigned long long v);
+// copies `h' into `out' ; the copy is consistent enough for reporting, not
+// exact while `h' is being added to
+void hist_snapshot(const struct hist *h, struct hist *out);
+// the upper bound of the bucket holding the `p'th percentile (0 < p <= 100),
+// clamped to the largest value seen ; 0 for an empty histogram
+unsigned long long hist_percentile(const struct hist *h, double p);
+
+#endif
+
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2012-2014 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef IO_H_
+#define IO_H_
+
+#include <stddef.h>
+
+struct audio_state;
+
+int read_file(struct audio_state *a, const char *filename, size_t size, double input[size]);
+int write_file_pcm(struct audio_state *a, const char *filename, size_t size, double output[size]);
+
+enum pcm_format {
+    PCM_U8,
+    PCM_S16,
+    PCM_S32,
+    PCM_FLOAT,
+    PCM_DOUBLE,
+};
+
+// looks up a sample format by its name ("u8", "s16", "s32", "f32", "f64")
+int pcm_format_parse(const char *name, enum pcm_format *format);
+// bytes per sample, or 0 for a value that is not a format
+size_t pcm_format_size(enum pcm_format format);
+// the libsndfile subtype (SF_FORMAT_PCM_16 etc.) for a sample format
+int pcm_format_sf(enum pcm_format format);
+// writes a WAV header with unknown lengths, for streaming samples to a pipe,
+// which libsndfile cannot do itself
+int wav_stream_header(int fd, unsigned rate, int channels, enum pcm_format format);
+
+// A read-only view of the little-endian sample data in a memory-mapped
+// file ; samples are converted only as they are read out of it.
+struct pcm_view {
+    const unsigned char *data;  // first frame
+    size_t frames;
+    unsigned rate;
+    int channels;
+    enum pcm_format format;
+    size_t frame_size;          // bytes per frame
+
+    void *map;
+    size_t map_len;
+};
+
+// maps an uncompressed WAV file ; fails with ENOTSUP for anything that needs
+// decoding, which callers should then read with libsndfile instead
+int pcm_map(struct pcm_view *v, const char *filename);
+// maps a headerless file of samples in `format'
+int pcm_map_raw(struct pcm_view *v, const char *filename, unsigned rate, int channels, enum pcm_format format);
+void pcm_unmap(struct pcm_view *v);
+
+// converts up to `count' frames of `channel' starting at frame `offset' to
+// doubles in [-1, 1), scaled as libsndfile would ; returns the number of
+// frames converted
+size_t pcm_read(const struct pcm_view *v, size_t offset, int channel, size_t count, double out[count]);
+
+#endif
+
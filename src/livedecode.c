@@ -0,0 +1,138 @@
+#define _XOPEN_SOURCE 600
+
+#include "livedecode.h"
+#include "streamdecode.h"
+#include "ring.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define LIVEDECODE_BLOCK 1024
+
+struct live_decoder {
+    struct stream_state *sd;
+    struct ring *ring;
+    pthread_t driver;
+    int done;
+    int rc;
+    // the driver sleeps on `wake' when the ring is empty, with `sleeping' set
+    // so that the producer only signals, and takes the lock, when it has to
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int sleeping;
+};
+
+// Setting `sleeping' before the second look at the ring pairs with the
+// producer filling the ring before it looks at `sleeping' : either the driver
+// sees the samples and does not sleep, or the producer sees the flag and
+// signals, which it cannot do before the driver is waiting since the driver
+// holds the lock until then.
+static void livedecode_sleep(struct live_decoder *l)
+{
+    pthread_mutex_lock(&l->lock);
+    __atomic_store_n(&l->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!ring_used(l->ring) && !__atomic_load_n(&l->done, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&l->wake, &l->lock);
+    __atomic_store_n(&l->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&l->lock);
+}
+
+static void livedecode_wake(struct live_decoder *l)
+{
+    pthread_mutex_lock(&l->lock);
+    pthread_cond_signal(&l->wake);
+    pthread_mutex_unlock(&l->lock);
+}
+
+static void *livedecode_driver(void *arg)
+{
+    struct live_decoder *l = arg;
+    double block[LIVEDECODE_BLOCK];
+
+    for (;;) {
+        // read `done' before draining so samples pushed before
+        // livedecode_stop are always decoded
+        int done = __atomic_load_n(&l->done, __ATOMIC_ACQUIRE);
+        size_t n = ring_read(l->ring, LIVEDECODE_BLOCK, block);
+
+        if (n) {
+            if (streamdecode_process(l->sd, n, block))
+                l->rc = -1;
+        } else if (done) {
+            break;
+        } else {
+            livedecode_sleep(l);
+        }
+    }
+
+    return NULL;
+}
+
+int livedecode_start(struct live_decoder **lp, struct stream_state *sd, size_t capacity)
+{
+    struct live_decoder *l = *lp = malloc(sizeof *l);
+    if (!l)
+        return -1;
+
+    l->sd   = sd;
+    l->done = 0;
+    l->rc   = 0;
+    l->sleeping = 0;
+    pthread_mutex_init(&l->lock, NULL);
+    pthread_cond_init(&l->wake, NULL);
+    l->ring = ring_create(sizeof(double), capacity);
+    if (!l->ring)
+        goto error;
+
+    if (pthread_create(&l->driver, NULL, livedecode_driver, l))
+        goto error;
+
+    return 0;
+error:
+    if (l->ring)
+        ring_destroy(l->ring);
+    pthread_cond_destroy(&l->wake);
+    pthread_mutex_destroy(&l->lock);
+    free(l);
+    *lp = NULL;
+    return -1;
+}
+
+size_t livedecode_push(struct live_decoder *l, size_t count, const double samples[count])
+{
+    size_t n = ring_write(l->ring, count, samples);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (n && __atomic_load_n(&l->sleeping, __ATOMIC_RELAXED))
+        livedecode_wake(l);
+
+    return n;
+}
+
+size_t livedecode_queued(struct live_decoder *l)
+{
+    return ring_used(l->ring);
+}
+
+void livedecode_counters(struct live_decoder *l, unsigned long *overruns, unsigned long *underruns)
+{
+    ring_counters(l->ring, overruns, underruns);
+}
+
+int livedecode_stop(struct live_decoder *l)
+{
+    pthread_mutex_lock(&l->lock);
+    __atomic_store_n(&l->done, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&l->wake);
+    pthread_mutex_unlock(&l->lock);
+    pthread_join(l->driver, NULL);
+
+    int rc = l->rc;
+    ring_destroy(l->ring);
+    pthread_cond_destroy(&l->wake);
+    pthread_mutex_destroy(&l->lock);
+    free(l);
+
+    return rc;
+}
+
@@ -0,0 +1,32 @@
+#ifndef LIVEDECODE_H_
+#define LIVEDECODE_H_
+
+#include "tynsel_api.h"
+
+#include <stddef.h>
+
+struct stream_state;
+
+// Runs a decoder on its own thread, fed through a ring from a real-time
+// thread (a sound card callback, a media thread, a socket reader) that must
+// never wait on the decoder. If the decoder falls behind by more than the
+// ring holds, the newest samples are dropped and counted.
+struct live_decoder;
+
+// `capacity' is in samples ; the decoder is not owned by the live_decoder,
+// and must not be touched by anyone else until livedecode_stop
+TYNSEL_API int livedecode_start(struct live_decoder **lp, struct stream_state *sd, size_t capacity);
+// returns the number of samples queued ; wait-free, except that when the
+// decoder has gone to sleep on an empty ring it briefly takes a lock to wake it
+TYNSEL_API size_t livedecode_push(struct live_decoder *l, size_t count, const double samples[count]);
+// samples queued and not yet decoded ; callable from any thread
+TYNSEL_API size_t livedecode_queued(struct live_decoder *l);
+// `overruns' counts samples dropped, `underruns' times the decoder found
+// nothing to do
+TYNSEL_API void livedecode_counters(struct live_decoder *l, unsigned long *overruns, unsigned long *underruns);
+// decodes whatever is still queued, then stops the thread ; returns -1 if the
+// decoder reported an error at any point
+TYNSEL_API int livedecode_stop(struct live_decoder *l);
+
+#endif
+
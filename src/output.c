@@ -0,0 +1,236 @@
+#include "output.h"
+#include "streamdecode.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the longest a single character can take in any format
+#define OUTPUT_MAX_RECORD 160
+
+struct output {
+    int fd;
+    enum output_format format;
+    int unbuffered;
+    int channel;
+    int tagged, timestamps;
+
+    size_t len, size;
+    char *buf;
+};
+
+static const char *format_names[] = {
+    [OUTPUT_TEXT]   = "text",
+    [OUTPUT_JSON]   = "json",
+    [OUTPUT_BINARY] = "binary",
+};
+
+int output_format_parse(const char *name, enum output_format *format)
+{
+    for (size_t i = 0; i < sizeof format_names / sizeof format_names[0]; i++) {
+        if (!strcmp(name, format_names[i])) {
+            *format = i;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static int write_all(int fd, const char *p, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int output_flush(struct output *o)
+{
+    int rc = write_all(o->fd, o->buf, o->len);
+    o->len = 0;
+    return rc;
+}
+
+static char *put_str(char *p, const char *s)
+{
+    size_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static char *put_uint(char *p, uint64_t x)
+{
+    char digits[20];
+    int n = 0;
+    do
+        digits[n++] = '0' + x % 10;
+    while (x /= 10);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+static char *put_int(char *p, int64_t x)
+{
+    if (x < 0) {
+        *p++ = '-';
+        return put_uint(p, -(uint64_t)x);
+    }
+    return put_uint(p, x);
+}
+
+// the same bytes as printf("char '%c' (%d)") and friends
+static char *put_text(struct output *o, char *p, int line, uint64_t offset, int status, int data)
+{
+    if (o->tagged) {
+        p = put_str(p, "line ");
+        p = put_int(p, line);
+        *p++ = ' ';
+    }
+
+    if (status == STREAM_ERR_OK || status == STREAM_ERR_PARITY) {
+        p = put_str(p, "char '");
+        *p++ = data;
+        p = put_str(p, "' (");
+        p = put_int(p, data);
+        *p++ = ')';
+        if (status == STREAM_ERR_PARITY)
+            p = put_str(p, " (PARITY FAILED)");
+    } else {
+        p = put_str(p, "unknown error");
+    }
+
+    if (o->timestamps && offset != OUTPUT_NO_OFFSET) {
+        p = put_str(p, " at ");
+        p = put_uint(p, offset);
+    }
+    *p++ = '\n';
+
+    return p;
+}
+
+static char *put_json(struct output *o, char *p, int line, uint64_t offset, int status, int data)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    p = put_str(p, "{\"offset\":");
+    if (offset == OUTPUT_NO_OFFSET)
+        p = put_str(p, "null");
+    else
+        p = put_uint(p, offset);
+    p = put_str(p, ",\"line\":");
+    p = put_int(p, line);
+    p = put_str(p, ",\"channel\":");
+    p = put_int(p, o->channel);
+    p = put_str(p, ",\"status\":");
+    p = put_str(p, status == STREAM_ERR_OK     ? "\"ok\"" :
+                   status == STREAM_ERR_PARITY ? "\"parity\"" : "\"error\"");
+    p = put_str(p, ",\"data\":");
+    p = put_int(p, data);
+
+    if (status == STREAM_ERR_OK || status == STREAM_ERR_PARITY) {
+        const unsigned char c = data;
+        p = put_str(p, ",\"char\":\"");
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            p = put_str(p, "\\u00");
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 15];
+        } else {
+            *p++ = c;
+        }
+        *p++ = '"';
+    }
+    p = put_str(p, "}\n");
+
+    return p;
+}
+
+int output_char(struct output *o, int line, uint64_t offset, int status, int data)
+{
+    if (o->size - o->len < OUTPUT_MAX_RECORD && output_flush(o))
+        return -1;
+
+    char *start = o->buf + o->len, *p = start;
+    switch (o->format) {
+        case OUTPUT_TEXT:
+            p = put_text(o, p, line, offset, status, data);
+            break;
+        case OUTPUT_JSON:
+            p = put_json(o, p, line, offset, status, data);
+            break;
+        case OUTPUT_BINARY: {
+            const struct output_record r = {
+                .offset  = offset,
+                .data    = data,
+                .line    = line,
+                .status  = status,
+                .channel = o->channel,
+            };
+            memcpy(p, &r, sizeof r);
+            p += sizeof r;
+            break;
+        }
+    }
+    o->len += p - start;
+
+    return o->unbuffered ? output_flush(o) : 0;
+}
+
+int output_open(struct output **op, int fd, enum output_format format, size_t bufsize,
+        int unbuffered, int channel, int tagged, int timestamps)
+{
+    if (bufsize < OUTPUT_MAX_RECORD)
+        bufsize = OUTPUT_MAX_RECORD;
+
+    struct output *o = calloc(1, sizeof *o);
+    if (!o)
+        return -1;
+    o->buf = malloc(bufsize);
+    if (!o->buf) {
+        free(o);
+        return -1;
+    }
+
+    o->fd         = fd;
+    o->format     = format;
+    o->unbuffered = unbuffered;
+    o->channel    = channel;
+    o->tagged     = tagged;
+    o->timestamps = timestamps;
+    o->size       = bufsize;
+
+    if (format == OUTPUT_BINARY) {
+        struct output_header h = {
+            .version     = OUTPUT_VERSION,
+            .record_size = sizeof(struct output_record),
+        };
+        memcpy(h.magic, OUTPUT_MAGIC, sizeof h.magic);
+        memcpy(o->buf, &h, sizeof h);
+        o->len = sizeof h;
+    }
+
+    *op = o;
+    return 0;
+}
+
+int output_close(struct output *o)
+{
+    int rc = output_flush(o);
+    free(o->buf);
+    free(o);
+    return rc;
+}
@@ -0,0 +1,59 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes decoded characters to a file descriptor through a buffer of its own,
+// without stdio, in one of three formats :
+//
+//   text    suite's traditional lines, "char 'A' (65)" and so on
+//   json    one object per line, e.g.
+//           {"offset":1234,"line":0,"channel":1,"status":"ok","data":65,"char":"A"}
+//           with "offset" null where it is not known, and "status" one of
+//           "ok", "parity" or "error"
+//   binary  an 8-byte header, then a struct output_record per character ; all
+//           in host byte order
+//
+// The buffer goes out when it fills, on output_flush and on output_close, or
+// after every character for an output opened unbuffered.
+
+enum output_format {
+    OUTPUT_TEXT,
+    OUTPUT_JSON,
+    OUTPUT_BINARY,
+};
+
+#define OUTPUT_MAGIC   "TYNO"
+#define OUTPUT_VERSION 1
+#define OUTPUT_NO_OFFSET UINT64_MAX
+
+struct output_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;   // sizeof(struct output_record), for skipping
+};
+
+struct output_record {
+    uint64_t offset;        // frame that completed the character, or OUTPUT_NO_OFFSET
+    int32_t data;           // the character, or the error code
+    uint16_t line;          // file channel
+    int8_t status;          // as for streamdecode_callback
+    uint8_t channel;        // modem channel
+};
+
+struct output;
+
+// looks up a format by its name ("text", "json", "binary")
+int output_format_parse(const char *name, enum output_format *format);
+
+// `tagged' text names the line of each character, and `timestamps' text its
+// offset ; the other formats always carry both
+int output_open(struct output **op, int fd, enum output_format format, size_t bufsize,
+        int unbuffered, int channel, int tagged, int timestamps);
+int output_char(struct output *o, int line, uint64_t offset, int status, int data);
+int output_flush(struct output *o);
+// flushes and frees `o' ; the caller keeps the file descriptor
+int output_close(struct output *o);
+
+#endif
@@ -0,0 +1,173 @@
+#include "reader.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct reader {
+    SNDFILE *sf;
+    int channels, channel;
+    size_t frames;
+
+    double *raw; // interleaved frames, when there is more than one channel
+    struct block {
+        double *samples;
+        sf_count_t count;
+        int full;
+    } blocks[2];
+    int current; // block handed to the consumer, or -1
+    int stop;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+};
+
+void deinterleave(size_t frames, int channels, int channel,
+        const double *restrict in, double *restrict out)
+{
+    in += channel;
+    // the common cases get constant strides, which the compiler can vectorise
+    switch (channels) {
+        case 2:
+            for (size_t i = 0; i < frames; i++)
+                out[i] = in[i * 2];
+            break;
+        case 4:
+            for (size_t i = 0; i < frames; i++)
+                out[i] = in[i * 4];
+            break;
+        case 8:
+            for (size_t i = 0; i < frames; i++)
+                out[i] = in[i * 8];
+            break;
+        default:
+            for (size_t i = 0; i < frames; i++)
+                out[i] = in[i * channels];
+            break;
+    }
+}
+
+static void *reader_thread(void *arg)
+{
+    struct reader *r = arg;
+    sf_count_t count;
+    int i = 0;
+    do {
+        struct block *b = &r->blocks[i];
+
+        pthread_mutex_lock(&r->lock);
+        while (b->full && !r->stop)
+            pthread_cond_wait(&r->cond, &r->lock);
+        int stop = r->stop;
+        pthread_mutex_unlock(&r->lock);
+        if (stop)
+            break;
+
+        if (r->channels == 1) {
+            count = sf_readf_double(r->sf, b->samples, r->frames);
+        } else {
+            count = sf_readf_double(r->sf, r->raw, r->frames);
+            if (count > 0 && r->channel >= 0)
+                deinterleave(count, r->channels, r->channel, r->raw, b->samples);
+            else if (count > 0)
+                for (int c = 0; c < r->channels; c++)
+                    deinterleave(count, r->channels, c, r->raw, &b->samples[c * r->frames]);
+        }
+        if (count <= 0 && sf_error(r->sf))
+            count = -1;
+
+        pthread_mutex_lock(&r->lock);
+        b->count = count;
+        b->full = 1;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+
+        i ^= 1;
+    } while (count > 0);
+
+    return NULL;
+}
+
+int reader_start(struct reader **rp, SNDFILE *sf, int channels, int channel, size_t frames)
+{
+    struct reader *r = *rp = calloc(1, sizeof *r);
+    if (!r)
+        return -1;
+
+    r->sf       = sf;
+    r->channels = channels;
+    r->channel  = channel;
+    r->frames   = frames;
+    r->current  = -1;
+
+    if (channels > 1 && !(r->raw = malloc(frames * channels * sizeof *r->raw)))
+        goto error;
+    const size_t planes = channel < 0 ? channels : 1;
+    for (int i = 0; i < 2; i++)
+        if (!(r->blocks[i].samples = malloc(frames * planes * sizeof *r->blocks[i].samples)))
+            goto error;
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    if (pthread_create(&r->thread, NULL, reader_thread, r)) {
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->lock);
+        goto error;
+    }
+
+    return 0;
+error:
+    free(r->blocks[1].samples);
+    free(r->blocks[0].samples);
+    free(r->raw);
+    free(r);
+    *rp = NULL;
+    return -1;
+}
+
+sf_count_t reader_next(struct reader *r, const double **samples)
+{
+    pthread_mutex_lock(&r->lock);
+
+    // give back the block the consumer had last
+    int next = 0;
+    if (r->current >= 0) {
+        struct block *done = &r->blocks[r->current];
+        if (done->count <= 0) {
+            // stay at end of file
+            pthread_mutex_unlock(&r->lock);
+            return done->count;
+        }
+        done->full = 0;
+        next = r->current ^ 1;
+        pthread_cond_broadcast(&r->cond);
+    }
+
+    struct block *b = &r->blocks[next];
+    while (!b->full)
+        pthread_cond_wait(&r->cond, &r->lock);
+    r->current = next;
+
+    pthread_mutex_unlock(&r->lock);
+
+    *samples = b->samples;
+    return b->count;
+}
+
+void reader_stop(struct reader *r)
+{
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+
+    pthread_join(r->thread, NULL);
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+
+    free(r->blocks[1].samples);
+    free(r->blocks[0].samples);
+    free(r->raw);
+    free(r);
+}
+
@@ -0,0 +1,27 @@
+#ifndef READER_H_
+#define READER_H_
+
+#include <sndfile.h>
+
+// Reads one channel of a file ahead of its consumer on a background thread.
+// Two blocks are in flight : while the consumer works on one, the reader
+// thread fills the other, so file I/O and format conversion overlap with
+// decoding.
+struct reader;
+
+// `frames' is the number of frames per block ; a negative `channel' selects
+// every channel, in which case a block holds channel c's frames at
+// [c * frames, c * frames + count). The reader does not take ownership of
+// `sf', which must not be touched until reader_stop
+int reader_start(struct reader **rp, SNDFILE *sf, int channels, int channel, size_t frames);
+// hands out the next block, valid until the following call ; returns the
+// number of frames in it, 0 at end of file or -1 on a read error
+sf_count_t reader_next(struct reader *r, const double **samples);
+void reader_stop(struct reader *r);
+
+// copies every `channels'th sample starting at `channel'
+void deinterleave(size_t frames, int channels, int channel,
+        const double *restrict in, double *restrict out);
+
+#endif
+
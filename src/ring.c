@@ -0,0 +1,142 @@
+#include "ring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RING_CACHE_LINE 64
+
+// The producer's and the consumer's fields are kept a cache line apart, so
+// that neither side's writes invalidate the other's line. Each side keeps a
+// copy of the other's index and only reloads it when the copy says the ring
+// is full (or empty).
+struct ring {
+    size_t mask;
+    size_t elem_size;
+    unsigned char *data;
+
+    char pad0[RING_CACHE_LINE];
+    size_t head;            // next slot to write ; written only by the producer
+    size_t tail_cache;      // producer's copy of tail
+    unsigned long overruns; // elements dropped because the ring was full
+
+    char pad1[RING_CACHE_LINE];
+    size_t tail;            // next slot to read ; written only by the consumer
+    size_t head_cache;      // consumer's copy of head
+    unsigned long underruns;// reads that found the ring empty
+
+    char pad2[RING_CACHE_LINE];
+};
+
+struct ring *ring_create(size_t elem_size, size_t count)
+{
+    if (elem_size == 0 || count == 0)
+        goto badparams;
+
+    size_t size = 1;
+    while (size < count)
+        size <<= 1;
+
+    struct ring *r = calloc(1, sizeof *r);
+    if (!r)
+        return NULL;
+
+    r->data = malloc(size * elem_size);
+    if (!r->data) {
+        free(r);
+        return NULL;
+    }
+
+    r->mask      = size - 1;
+    r->elem_size = elem_size;
+
+    return r;
+badparams:
+    errno = EINVAL;
+    return NULL;
+}
+
+// number of free slots, as far as the producer can tell
+static size_t space(const struct ring *r)
+{
+    return r->mask + 1 - (r->head - r->tail_cache);
+}
+
+// number of filled slots, as far as the consumer can tell
+static size_t avail(const struct ring *r)
+{
+    return r->head_cache - r->tail;
+}
+
+int ring_put(struct ring *r, const void *elem)
+{
+    return ring_write(r, 1, elem) ? 0 : -1;
+}
+
+int ring_get(struct ring *r, void *elem)
+{
+    return ring_read(r, 1, elem) ? 0 : -1;
+}
+
+size_t ring_write(struct ring *r, size_t count, const void *elems)
+{
+    size_t n = space(r);
+    if (n < count) {
+        // the copy may just be stale
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        n = space(r);
+    }
+    if (n > count)
+        n = count;
+    if (n < count)
+        __atomic_store_n(&r->overruns, r->overruns + (count - n), __ATOMIC_RELAXED);
+
+    // copy in at most two pieces, around the end of the buffer
+    const size_t head = r->head, size = r->mask + 1, at = head & r->mask;
+    const size_t first = n < size - at ? n : size - at;
+    memcpy(&r->data[at * r->elem_size], elems, first * r->elem_size);
+    memcpy(r->data, (const unsigned char *)elems + first * r->elem_size, (n - first) * r->elem_size);
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+size_t ring_read(struct ring *r, size_t count, void *elems)
+{
+    size_t n = avail(r);
+    if (n < count) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        n = avail(r);
+    }
+    if (n > count)
+        n = count;
+    if (n == 0 && count > 0)
+        __atomic_store_n(&r->underruns, r->underruns + 1, __ATOMIC_RELAXED);
+
+    const size_t tail = r->tail, size = r->mask + 1, at = tail & r->mask;
+    const size_t first = n < size - at ? n : size - at;
+    memcpy(elems, &r->data[at * r->elem_size], first * r->elem_size);
+    memcpy((unsigned char *)elems + first * r->elem_size, r->data, (n - first) * r->elem_size);
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+size_t ring_used(struct ring *r)
+{
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)
+         - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+void ring_counters(struct ring *r, unsigned long *overruns, unsigned long *underruns)
+{
+    *overruns  = __atomic_load_n(&r->overruns, __ATOMIC_RELAXED);
+    *underruns = __atomic_load_n(&r->underruns, __ATOMIC_RELAXED);
+}
+
+void ring_destroy(struct ring *r)
+{
+    free(r->data);
+    free(r);
+}
+
@@ -0,0 +1,25 @@
+#ifndef RING_H_
+#define RING_H_
+
+#include <stddef.h>
+
+// A single-producer, single-consumer ring of fixed-size elements. Neither side
+// ever blocks : ring_put fails when the ring is full and ring_get fails when
+// it is empty. Exactly one thread may put and exactly one thread may get.
+struct ring;
+
+// `count' is rounded up to a power of two
+struct ring *ring_create(size_t elem_size, size_t count);
+int ring_put(struct ring *r, const void *elem);
+int ring_get(struct ring *r, void *elem);
+// bulk versions, returning the number of elements copied ; elements that do
+// not fit are dropped and counted as overruns, and a read that finds the
+// ring empty counts as an underrun
+size_t ring_write(struct ring *r, size_t count, const void *elems);
+size_t ring_read(struct ring *r, size_t count, void *elems);
+size_t ring_used(struct ring *r);
+void ring_counters(struct ring *r, unsigned long *overruns, unsigned long *underruns);
+void ring_destroy(struct ring *r);
+
+#endif
+
@@ -0,0 +1,240 @@
+#include "rtp.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the most frames of missing audio reported as one gap ; a bigger jump in
+// the timestamps is taken as the sender starting afresh, not as loss
+#define RTP_MAX_GAP 65536
+
+static uint16_t get16(const unsigned char *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put16(unsigned char *p, uint16_t x)
+{
+    p[0] = x >> 8;
+    p[1] = x;
+}
+
+static void put32(unsigned char *p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+int rtp_parse(size_t len, const unsigned char buf[len], struct rtp_packet *p)
+{
+    if (len < RTP_HEADER_SIZE || buf[0] >> 6 != 2)
+        return -1;
+
+    size_t start = RTP_HEADER_SIZE + (buf[0] & 0x0f) * 4;
+    if (buf[0] & 0x10) {
+        // an extension : a 4-byte header giving its length in words
+        if (len < start + 4)
+            return -1;
+        start += 4 + get16(&buf[start + 2]) * 4;
+    }
+    size_t end = len;
+    if (buf[0] & 0x20) {
+        if (buf[len - 1] == 0 || buf[len - 1] > len)
+            return -1;
+        end -= buf[len - 1];
+    }
+    if (start > end)
+        return -1;
+
+    p->marker  = buf[1] >> 7;
+    p->pt      = buf[1] & 0x7f;
+    p->seq     = get16(&buf[2]);
+    p->ts      = get32(&buf[4]);
+    p->ssrc    = get32(&buf[8]);
+    p->payload = &buf[start];
+    p->len     = end - start;
+
+    return 0;
+}
+
+size_t rtp_build(unsigned char *buf, const struct rtp_packet *p)
+{
+    buf[0] = 2 << 6;
+    buf[1] = (p->marker ? 0x80 : 0) | (p->pt & 0x7f);
+    put16(&buf[2], p->seq);
+    put32(&buf[4], p->ts);
+    put32(&buf[8], p->ssrc);
+    memcpy(&buf[RTP_HEADER_SIZE], p->payload, p->len);
+
+    return RTP_HEADER_SIZE + p->len;
+}
+
+struct rtp_jitter {
+    unsigned depth;
+    size_t mask;            // slots - 1 ; the slots cover the packets from next_seq on
+    struct slot {
+        int used;
+        struct rtp_packet p;
+        unsigned char payload[RTP_MAX_PAYLOAD];
+    } *slots;
+    unsigned count;         // slots in use
+
+    int started;
+    int emitted;            // anything taken out yet
+    uint16_t next_seq;      // the packet due out next
+    uint32_t next_ts;       // and the timestamp it should have
+    uint16_t top;           // highest sequence number accepted
+
+    struct rtp_jitter_stats stats;
+};
+
+int rtp_jitter_init(struct rtp_jitter **jp, unsigned depth)
+{
+    if (depth == 0 || depth > 0x4000) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // twice the depth, so that a packet that has just overtaken `depth'
+    // others still has a slot of its own
+    size_t slots = 1;
+    while (slots < 2 * depth)
+        slots <<= 1;
+
+    struct rtp_jitter *j = calloc(1, sizeof *j);
+    if (!j)
+        return -1;
+    j->slots = calloc(slots, sizeof *j->slots);
+    if (!j->slots) {
+        free(j);
+        return -1;
+    }
+    j->depth = depth;
+    j->mask  = slots - 1;
+
+    *jp = j;
+    return 0;
+}
+
+int rtp_jitter_put(struct rtp_jitter *j, const struct rtp_packet *p)
+{
+    if (p->len > RTP_MAX_PAYLOAD) {
+        j->stats.discarded++;
+        return 1;
+    }
+
+    if (!j->started) {
+        j->started  = 1;
+        j->next_seq = p->seq;
+        j->next_ts  = p->ts;
+        j->top      = p->seq;
+    }
+
+    int ahead = (int16_t)(p->seq - j->next_seq);
+    if (ahead < 0 && !j->emitted && (uint16_t)(j->top - p->seq) <= j->mask) {
+        // overtaken by the packet the stream was started from, before any
+        // of it has gone out : start from this one instead
+        j->next_seq = p->seq;
+        j->next_ts  = p->ts;
+        ahead = 0;
+    }
+    if (ahead < 0) {
+        j->stats.late++;
+        return 1;
+    }
+    if ((size_t)ahead > j->mask) {
+        // too far ahead to buffer ; that can only be followed once nothing
+        // older is waiting, and is taken as loss if the timestamps agree,
+        // or else as the sender starting afresh
+        if (j->count) {
+            j->stats.discarded++;
+            return 1;
+        }
+        if (p->ts - j->next_ts <= RTP_MAX_GAP)
+            j->stats.lost += ahead;
+        j->next_seq = p->seq;
+        j->top      = p->seq;
+    }
+
+    struct slot *s = &j->slots[p->seq & j->mask];
+    if (s->used) {
+        j->stats.duplicates++;
+        return 1;
+    }
+
+    s->used = 1;
+    s->p = *p;
+    memcpy(s->payload, p->payload, p->len);
+    s->p.payload = s->payload;
+    j->count++;
+
+    if ((int16_t)(p->seq - j->top) < 0)
+        j->stats.reordered++;
+    else
+        j->top = p->seq;
+    j->stats.packets++;
+
+    return 0;
+}
+
+int rtp_jitter_get(struct rtp_jitter *j, int drain, struct rtp_packet *p, size_t *gap)
+{
+    if (!j->count)
+        return 0;
+
+    // hold the start back until the buffer has filled, in case the first
+    // packet to arrive was not the first sent
+    if (!j->emitted && j->count < j->depth && !drain)
+        return 0;
+
+    struct slot *s = &j->slots[j->next_seq & j->mask];
+    if (!s->used) {
+        if (j->count < j->depth && !drain)
+            return 0;
+
+        // give up on what is missing, up to the oldest packet there is
+        unsigned skip = 1;
+        while (!(s = &j->slots[(uint16_t)(j->next_seq + skip) & j->mask])->used)
+            skip++;
+        j->stats.lost += skip;
+        j->next_seq += skip;
+    }
+
+    // report the audio missing before the packet, whether lost or never sent
+    const uint32_t missing = s->p.ts - j->next_ts;
+    if (missing > 0 && missing <= RTP_MAX_GAP) {
+        j->next_ts = s->p.ts;
+        *gap = missing;
+        p->len = 0;
+        return 1;
+    }
+
+    s->used = 0;
+    j->count--;
+    j->emitted = 1;
+    *p = s->p;
+    j->next_seq++;
+    j->next_ts = p->ts + p->len;
+
+    return 1;
+}
+
+void rtp_jitter_stats(const struct rtp_jitter *j, struct rtp_jitter_stats *st)
+{
+    *st = j->stats;
+}
+
+void rtp_jitter_fini(struct rtp_jitter *j)
+{
+    if (!j)
+        return;
+    free(j->slots);
+    free(j);
+}
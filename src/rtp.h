@@ -0,0 +1,60 @@
+#ifndef RTP_H_
+#define RTP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// RTP (RFC 3550) as far as carrying G.711 audio needs it
+
+#define RTP_HEADER_SIZE 12
+// the largest payload kept ; 20 ms of G.711 is 160 bytes
+#define RTP_MAX_PAYLOAD 1024
+
+#define RTP_PT_PCMU 0
+#define RTP_PT_PCMA 8
+
+struct rtp_packet {
+    int pt;                 // payload type
+    int marker;
+    uint16_t seq;
+    uint32_t ts;            // in frames, for G.711
+    uint32_t ssrc;
+    size_t len;             // bytes of payload
+    const unsigned char *payload;
+};
+
+// fills in *p from the `len' bytes at `buf', skipping any CSRCs, header
+// extension and padding ; returns -1 if they are not an RTP version 2 packet
+int rtp_parse(size_t len, const unsigned char buf[len], struct rtp_packet *p);
+// writes the header of `p' and its payload to `buf', which must hold
+// RTP_HEADER_SIZE + p->len bytes ; returns the number of bytes written
+size_t rtp_build(unsigned char *buf, const struct rtp_packet *p);
+
+// A reorder buffer for one stream : packets go in as they arrive, and come
+// out in sequence. A packet still missing when `depth' later ones have
+// arrived is given up on, and the audio it would have held reported as a
+// gap, from the timestamps on either side. Packets from before the point
+// reached are dropped as late (or duplicate).
+struct rtp_jitter;
+
+struct rtp_jitter_stats {
+    unsigned long packets;      // accepted
+    unsigned long late;         // dropped for arriving after their turn
+    unsigned long duplicates;
+    unsigned long lost;         // given up on
+    unsigned long reordered;    // accepted out of order
+    unsigned long discarded;    // too long, or too far ahead of those awaited
+};
+
+int rtp_jitter_init(struct rtp_jitter **jp, unsigned depth);
+// copies `p' in ; returns 0 if it was accepted, 1 if it was dropped
+int rtp_jitter_put(struct rtp_jitter *j, const struct rtp_packet *p);
+// Takes out what comes next, if it is ready : returns 1 with the next packet
+// in *p (its payload valid until the next put or get), 1 with p->len == 0 and
+// *gap set to the frames lost before the next packet, or 0 if nothing is
+// ready. With `drain', anything buffered is ready.
+int rtp_jitter_get(struct rtp_jitter *j, int drain, struct rtp_packet *p, size_t *gap);
+void rtp_jitter_stats(const struct rtp_jitter *j, struct rtp_jitter_stats *st);
+void rtp_jitter_fini(struct rtp_jitter *j);
+
+#endif
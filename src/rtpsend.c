@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2012-2014 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+// Replays an 8 kHz audio file, such as gen makes, as G.711 RTP streams over
+// UDP, for trying out rtpserve. Each stream has an SSRC of its own and goes to
+// one of a range of ports ; packets can be dropped or swapped with the next
+// one at random, to exercise the receiver's reorder buffer.
+
+#define _XOPEN_SOURCE 600
+
+#include "g711.h"
+#include "rtp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sndfile.h>
+
+#define RATE 8000
+
+struct rtpsend_opts {
+    const char *host;
+    unsigned port, ports;   // streams go round-robin to [port, port + ports)
+    unsigned streams;
+    enum g711_law law;
+    unsigned frames;        // per packet
+    uint32_t ssrc;          // of the first stream ; the rest count up from it
+    double speed;           // relative to real time, 0 for as fast as possible
+    double reorder, drop;   // chances per packet
+};
+
+struct sender {
+    int fd;
+    struct sockaddr_in dest;
+    unsigned long sent;
+};
+
+// a stream's packet held back to go after the next one
+struct held {
+    int valid;
+    unsigned char buf[RTP_HEADER_SIZE + RTP_MAX_PAYLOAD];
+    size_t len;
+    unsigned port;
+};
+
+static int send_packet(struct sender *s, unsigned port, size_t len, const unsigned char buf[len])
+{
+    s->dest.sin_port = htons(port);
+    if (sendto(s->fd, buf, len, 0, (struct sockaddr *)&s->dest, sizeof s->dest) < 0)
+        return -1;
+    s->sent++;
+    return 0;
+}
+
+static void pace(const struct timespec *start, double seconds)
+{
+    const long long ns = seconds * 1e9;
+    struct timespec until = {
+        .tv_sec  = start->tv_sec + (start->tv_nsec + ns) / 1000000000,
+        .tv_nsec = (start->tv_nsec + ns) % 1000000000,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+        ;
+}
+
+static int parse_opts(struct rtpsend_opts *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "h:p:P:n:b:s:f:R:D:" "a")) != -1) {
+        switch (ch) {
+            case 'h': o->host    = optarg;                   break;
+            case 'p': o->port    = strtol(optarg, NULL, 0);  break;
+            case 'P': o->ports   = strtol(optarg, NULL, 0);  break;
+            case 'n': o->streams = strtol(optarg, NULL, 0);  break;
+            case 'b': o->frames  = strtol(optarg, NULL, 0);  break;
+            case 's': o->ssrc    = strtoul(optarg, NULL, 0); break;
+            case 'f': o->speed   = strtod(optarg, NULL);     break;
+            case 'R': o->reorder = strtod(optarg, NULL);     break;
+            case 'D': o->drop    = strtod(optarg, NULL);     break;
+            case 'a': o->law     = G711_ALAW;                break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Supply an input filename\n");
+        return -1;
+    }
+    if (o->ports == 0 || o->streams == 0 || o->frames == 0 || o->frames > RTP_MAX_PAYLOAD) {
+        fprintf(stderr, "Bad port range, stream count or packet size\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct rtpsend_opts opts = {
+        .host    = "127.0.0.1",
+        .port    = 5004,
+        .ports   = 1,
+        .streams = 1,
+        .law     = G711_ULAW,
+        .frames  = 160,
+        .ssrc    = 0x7e550000,
+        .speed   = 1,
+        .reorder = 0,
+        .drop    = 0,
+    };
+    if (parse_opts(&opts, argc, argv))
+        return EXIT_FAILURE;
+
+    const char *filename = argv[optind];
+    SF_INFO sinfo = { .format = 0 };
+    SNDFILE *sf = sf_open(filename, SFM_READ, &sinfo);
+    if (!sf) {
+        fprintf(stderr, "Failed to open `%s' for reading : %s\n", filename, sf_strerror(NULL));
+        return EXIT_FAILURE;
+    }
+    if (sinfo.samplerate != RATE) {
+        fprintf(stderr, "G.711 runs at %d Hz, but `%s' is at %d Hz\n", RATE, filename, sinfo.samplerate);
+        return EXIT_FAILURE;
+    }
+
+    // the first channel, companded once for all the streams
+    short *pcm = malloc(sinfo.frames * sinfo.channels * sizeof *pcm);
+    unsigned char *codes = malloc(sinfo.frames);
+    if (!pcm || !codes || sf_readf_short(sf, pcm, sinfo.frames) != sinfo.frames) {
+        fprintf(stderr, "Failed to read `%s'\n", filename);
+        return EXIT_FAILURE;
+    }
+    for (sf_count_t i = 0; i < sinfo.frames; i++)
+        codes[i] = g711_encode(opts.law, pcm[i * sinfo.channels]);
+    free(pcm);
+    sf_close(sf);
+
+    struct sender s = { .dest.sin_family = AF_INET };
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM }, *ai;
+    int gai = getaddrinfo(opts.host, NULL, &hints, &ai);
+    if (gai) {
+        fprintf(stderr, "Failed to look up `%s' : %s\n", opts.host, gai_strerror(gai));
+        return EXIT_FAILURE;
+    }
+    s.dest.sin_addr = ((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+    freeaddrinfo(ai);
+    if ((s.fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    struct held *held = calloc(opts.streams, sizeof *held);
+    if (!held)
+        return EXIT_FAILURE;
+
+    const size_t packets = (sinfo.frames + opts.frames - 1) / opts.frames;
+    unsigned long dropped = 0, swapped = 0;
+    unsigned seed = 1;
+    int rc = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t k = 0; k < packets && !rc; k++) {
+        const size_t at = k * opts.frames;
+        for (unsigned i = 0; i < opts.streams && !rc; i++) {
+            // sequence numbers start just short of wrapping, to exercise that
+            struct rtp_packet p = {
+                .pt      = opts.law == G711_ALAW ? RTP_PT_PCMA : RTP_PT_PCMU,
+                .marker  = k == 0,
+                .seq     = 0xffff - 16 + i + k,
+                .ts      = i * 1000003u + at,
+                .ssrc    = opts.ssrc + i,
+                .len     = sinfo.frames - at < opts.frames ? sinfo.frames - at : opts.frames,
+                .payload = &codes[at],
+            };
+            const unsigned port = opts.port + i % opts.ports;
+
+            if ((double)rand_r(&seed) / RAND_MAX < opts.drop) {
+                dropped++;
+                continue;
+            }
+
+            unsigned char buf[RTP_HEADER_SIZE + RTP_MAX_PAYLOAD];
+            size_t len = rtp_build(buf, &p);
+            struct held *h = &held[i];
+            if (!h->valid && (double)rand_r(&seed) / RAND_MAX < opts.reorder) {
+                memcpy(h->buf, buf, len);
+                h->len = len;
+                h->port = port;
+                h->valid = 1;
+                swapped++;
+                continue;
+            }
+
+            rc = send_packet(&s, port, len, buf);
+            if (!rc && h->valid) {
+                rc = send_packet(&s, h->port, h->len, h->buf);
+                h->valid = 0;
+            }
+        }
+
+        if (opts.speed > 0)
+            pace(&start, (double)(at + opts.frames) / RATE / opts.speed);
+    }
+    for (unsigned i = 0; i < opts.streams && !rc; i++)
+        if (held[i].valid)
+            rc = send_packet(&s, held[i].port, held[i].len, held[i].buf);
+
+    if (rc)
+        perror("Failed to send");
+    fprintf(stderr, "sent %lu packets on %u streams, %lu dropped, %lu reordered\n",
+            s.sent, opts.streams, dropped, swapped);
+
+    close(s.fd);
+    free(held);
+    free(codes);
+
+    return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
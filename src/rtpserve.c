@@ -0,0 +1,432 @@
+/*
+ * Copyright (c) 2012-2014 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+// Decodes plain RTP streams of G.711 (PCMU or PCMA) sent to a range of local
+// UDP ports, without a SIP stack : one thread waits on all the ports with
+// epoll, and each SSRC gets a reorder buffer and a decoder of its own.
+// Characters go to stdout tagged with the stream's number, in the way that
+// suite -a tags them with the line, and a line goes to stderr as each stream
+// begins and ends. A stream ends when nothing has come from it for a while.
+
+#define _GNU_SOURCE
+
+#include "streamdecode.h"
+#include "audio.h"
+#include "g711.h"
+#include "rtp.h"
+#include "output.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// datagrams taken from a socket at a time
+#define BATCH 32
+#define DATAGRAM_SIZE 2048
+// how often to look for streams that have gone quiet
+#define SWEEP_MS 250
+#define HASH_BITS 10
+#define OUTPUT_BUFFER (1 << 16)
+// asked of the kernel for each socket, to ride out bursts
+#define SOCKET_BUFFER (4 << 20)
+
+struct rtpserve_opts {
+    unsigned port, ports;   // listens on ports [port, port + ports)
+    unsigned depth;         // packets a lost one is waited for
+    unsigned idle;          // seconds of silence that end a stream
+    unsigned max_streams;
+    int exit_idle;          // exit once every stream seen has ended
+    int timestamps;
+    enum output_format output;
+};
+
+struct stream {
+    struct stream *next;    // in its hash bucket
+    struct server *srv;
+    uint32_t ssrc;
+    int index;
+    struct stream_state *sd;
+    struct rtp_jitter *jitter;
+    unsigned long long frames;      // decoded, including silence for gaps
+    unsigned long long concealed;   // of those, silence
+    unsigned long chars;
+    struct timespec last;           // last packet
+};
+
+struct server {
+    struct rtpserve_opts opts;
+    struct audio_state as;
+    int channel;
+    struct output *out;
+
+    struct stream *buckets[1 << HASH_BITS];
+    unsigned active;
+    int streams;            // ever seen, and the next stream's number
+    unsigned long bad;      // datagrams that were not G.711 RTP, or had no room
+};
+
+static volatile sig_atomic_t quit;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+static int emit(void *userdata, int status, int data)
+{
+    struct stream *s = userdata;
+    // the tick wraps, but never by more than a packet behind `frames'
+    const unsigned tick = streamdecode_tick(s->sd);
+    const uint64_t offset = s->frames + (unsigned)(tick - (unsigned)s->frames);
+    s->chars++;
+
+    return output_char(s->srv->out, s->index, offset, status, data);
+}
+
+static unsigned hash(uint32_t ssrc)
+{
+    return (ssrc * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static long ms_between(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1000 + (b->tv_nsec - a->tv_nsec) / 1000000;
+}
+
+static struct stream *stream_find(struct server *srv, uint32_t ssrc, const struct sockaddr_in *from, unsigned port)
+{
+    struct stream **b = &srv->buckets[hash(ssrc)];
+    for (struct stream *s = *b; s; s = s->next)
+        if (s->ssrc == ssrc)
+            return s;
+
+    if (srv->active >= srv->opts.max_streams)
+        return NULL;
+
+    struct stream *s = calloc(1, sizeof *s);
+    if (!s)
+        return NULL;
+    s->srv  = srv;
+    s->ssrc = ssrc;
+    if (rtp_jitter_init(&s->jitter, srv->opts.depth)
+            || streamdecode_init(&s->sd, &srv->as, s, emit, srv->channel)) {
+        rtp_jitter_fini(s->jitter);
+        free(s);
+        return NULL;
+    }
+    s->index = srv->streams++;
+    s->next = *b;
+    *b = s;
+    srv->active++;
+
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &from->sin_addr, addr, sizeof addr);
+    fprintf(stderr, "stream %d ssrc %08x from %s:%u on port %u\n",
+            s->index, ssrc, addr, ntohs(from->sin_port), port);
+
+    return s;
+}
+
+static int decode(struct stream *s, size_t count, const double samples[count])
+{
+    int rc = streamdecode_process(s->sd, count, samples);
+    s->frames += count;
+    return rc;
+}
+
+// decodes whatever the reorder buffer has ready
+static int stream_pump(struct stream *s, int drain)
+{
+    static const double silence[RTP_MAX_PAYLOAD];
+    double block[RTP_MAX_PAYLOAD];
+    struct rtp_packet p;
+    size_t gap;
+    int rc = 0;
+
+    while (!rc && rtp_jitter_get(s->jitter, drain, &p, &gap)) {
+        if (p.len) {
+            g711_decode(g711_table(p.pt == RTP_PT_PCMA ? G711_ALAW : G711_ULAW), p.len, p.payload, block);
+            rc = decode(s, p.len, block);
+        } else {
+            s->concealed += gap;
+            while (gap && !rc) {
+                size_t n = gap < RTP_MAX_PAYLOAD ? gap : RTP_MAX_PAYLOAD;
+                rc = decode(s, n, silence);
+                gap -= n;
+            }
+        }
+    }
+
+    return rc;
+}
+
+static void stream_end(struct server *srv, struct stream *s)
+{
+    stream_pump(s, 1);
+
+    struct rtp_jitter_stats st;
+    rtp_jitter_stats(s->jitter, &st);
+    fprintf(stderr, "stream %d ssrc %08x ended : %lu packets, %lu lost, %lu late, "
+                    "%lu reordered, %lu duplicates, %llu frames concealed, %lu characters\n",
+            s->index, s->ssrc, st.packets, st.lost, st.late, st.reordered, st.duplicates,
+            s->concealed, s->chars);
+
+    struct stream **b = &srv->buckets[hash(s->ssrc)];
+    while (*b != s)
+        b = &(*b)->next;
+    *b = s->next;
+    srv->active--;
+
+    streamdecode_fini(s->sd);
+    rtp_jitter_fini(s->jitter);
+    free(s);
+}
+
+static void sweep(struct server *srv, const struct timespec *now, int all)
+{
+    for (size_t i = 0; i < sizeof srv->buckets / sizeof srv->buckets[0]; i++) {
+        struct stream *s = srv->buckets[i];
+        while (s) {
+            struct stream *next = s->next;
+            if (all || ms_between(&s->last, now) >= (long)srv->opts.idle * 1000)
+                stream_end(srv, s);
+            s = next;
+        }
+    }
+}
+
+static void handle(struct server *srv, size_t len, const unsigned char *buf,
+        const struct sockaddr_in *from, unsigned port, const struct timespec *now)
+{
+    struct rtp_packet p;
+    if (rtp_parse(len, buf, &p) || (p.pt != RTP_PT_PCMU && p.pt != RTP_PT_PCMA)) {
+        srv->bad++;
+        return;
+    }
+
+    struct stream *s = stream_find(srv, p.ssrc, from, port);
+    if (!s) {
+        srv->bad++;
+        return;
+    }
+
+    s->last = *now;
+    if (!rtp_jitter_put(s->jitter, &p) && stream_pump(s, 0))
+        fprintf(stderr, "stream %d : decoding failed\n", s->index);
+}
+
+// takes every datagram waiting on `fd'
+static void receive(struct server *srv, int fd, unsigned port)
+{
+    static unsigned char bufs[BATCH][DATAGRAM_SIZE];
+    struct sockaddr_in from[BATCH];
+    struct iovec iov[BATCH];
+    struct mmsghdr msgs[BATCH];
+
+    for (;;) {
+        for (int i = 0; i < BATCH; i++) {
+            iov[i] = (struct iovec){ .iov_base = bufs[i], .iov_len = sizeof bufs[i] };
+            msgs[i] = (struct mmsghdr){ .msg_hdr = {
+                .msg_name    = &from[i],
+                .msg_namelen = sizeof from[i],
+                .msg_iov     = &iov[i],
+                .msg_iovlen  = 1,
+            } };
+        }
+
+        int n = recvmmsg(fd, msgs, BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+            break;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (int i = 0; i < n; i++)
+            handle(srv, msgs[i].msg_len, bufs[i], &from[i], port, &now);
+
+        if (n < BATCH)
+            break;
+    }
+}
+
+static int listen_on(int epfd, unsigned port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+
+    int size = SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+
+    struct sockaddr_in sin = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = (uint64_t)port << 32 | fd };
+    if (bind(fd, (struct sockaddr *)&sin, sizeof sin) || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return -1;
+    }
+
+    return fd;
+}
+
+static int parse_opts(struct rtpserve_opts *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "p:n:j:I:m:O:" "et")) != -1) {
+        switch (ch) {
+            case 'p': o->port        = strtol(optarg, NULL, 0); break;
+            case 'n': o->ports       = strtol(optarg, NULL, 0); break;
+            case 'j': o->depth       = strtol(optarg, NULL, 0); break;
+            case 'I': o->idle        = strtol(optarg, NULL, 0); break;
+            case 'm': o->max_streams = strtol(optarg, NULL, 0); break;
+            case 'e': o->exit_idle   = 1;                       break;
+            case 't': o->timestamps  = 1;                       break;
+            case 'O':
+                if (output_format_parse(optarg, &o->output)) {
+                    fprintf(stderr, "Unknown output format `%s'\n", optarg);
+                    return -1;
+                }
+                break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Supply channel number\n");
+        return -1;
+    }
+    if (o->ports == 0 || o->port + o->ports > 65536 || o->depth == 0 || o->idle == 0) {
+        fprintf(stderr, "Bad port range, reorder depth or idle time\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct server srv = {
+        .opts = {
+            .port        = 5004,
+            .ports       = 1,
+            .depth       = 4,
+            .idle        = 5,
+            .max_streams = 1024,
+            .exit_idle   = 0,
+            .timestamps  = 0,
+            .output      = OUTPUT_TEXT,
+        },
+        .as = {
+            .sample_rate = 8000,
+            .baud_rate   = 300,
+            .start_bits  = 1,
+            .data_bits   = 7,
+            .parity_bits = 1,
+            .stop_bits   = 2,
+            .freqs       = bell103_freqs,
+        },
+    };
+    if (parse_opts(&srv.opts, argc, argv))
+        return EXIT_FAILURE;
+    srv.channel = strtol(argv[optind], NULL, 0);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    if (output_open(&srv.out, STDOUT_FILENO, srv.opts.output, OUTPUT_BUFFER, 0,
+                    srv.channel, 1, srv.opts.timestamps)) {
+        fprintf(stderr, "Failed to set up output : %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < srv.opts.ports; i++) {
+        if (listen_on(epfd, srv.opts.port + i) < 0) {
+            fprintf(stderr, "Failed to listen on port %u : %s\n", srv.opts.port + i, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct timespec last_sweep;
+    clock_gettime(CLOCK_MONOTONIC, &last_sweep);
+
+    int rc = 0;
+    while (!quit && !rc) {
+        struct epoll_event events[64];
+        int n = epoll_wait(epfd, events, 64, SWEEP_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            rc = -1;
+        }
+        for (int i = 0; i < n; i++)
+            receive(&srv, (int)events[i].data.u64, events[i].data.u64 >> 32);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (ms_between(&last_sweep, &now) >= SWEEP_MS) {
+            sweep(&srv, &now, 0);
+            last_sweep = now;
+        }
+        // one write per wakeup, however many characters it brought
+        if (output_flush(srv.out)) {
+            perror("Failed to write output");
+            rc = -1;
+        }
+
+        if (srv.opts.exit_idle && srv.streams && !srv.active)
+            break;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sweep(&srv, &now, 1);
+    if (srv.bad)
+        fprintf(stderr, "Ignored %lu datagrams\n", srv.bad);
+
+    if (output_close(srv.out)) {
+        perror("Failed to write output");
+        rc = -1;
+    }
+    close(epfd);
+
+    return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+#include "audio.h"
+#include "burst.h"
+#include "filedecode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+int main(int argc, char *argv[])
+{
+    const char *index_file = NULL;
+    enum fsk_profile profile = FSK_PROFILE_BELL103;
+    int verbosity = 0;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "o:p:" "v")) != -1) {
+        switch (ch) {
+            case 'o': index_file = optarg; break;
+            case 'v': verbosity++;         break;
+            case 'p':
+                if (fsk_profile_parse(optarg, &profile)) {
+                    fprintf(stderr, "Unknown modem profile `%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-v] [-p profile] [-o index-file] input-file\n"
+                        "Writes an index of carrier bursts (by default to input-file.bursts)\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *filename = argv[optind];
+    char default_index[strlen(filename) + sizeof ".bursts"];
+    if (!index_file) {
+        snprintf(default_index, sizeof default_index, "%s.bursts", filename);
+        index_file = default_index;
+    }
+
+    struct audio_state as = {
+        .start_bits  = 1,
+        .data_bits   = 7,
+        .parity_bits = 1,
+        .stop_bits   = 2,
+    };
+    // the baud rate and tones ; suite -x only reuses an index made for its own
+    audio_set_profile(&as, profile);
+
+    struct burst_list list = { .count = 0 };
+    size_t total;
+    if (burst_scan_file(filename, &as, &total, &list, burst_collect)) {
+        fprintf(stderr, "Failed to scan `%s' : %s\n", filename, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    size_t frames = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        const struct burst *b = &list.bursts[i];
+        frames += b->end - b->start;
+        if (verbosity)
+            printf("channel %d : %zu - %zu level %g\n", b->channel, b->start, b->end, b->level);
+    }
+
+    if (burst_index_write(index_file, &as, total, list.count, list.bursts)) {
+        fprintf(stderr, "Failed to write `%s' : %s\n", index_file, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu bursts, %zu of %zu frames\n", list.count, frames, total);
+    free(list.bursts);
+
+    return 0;
+}
+
@@ -0,0 +1,197 @@
+#include "session.h"
+#include "audio.h"
+#include "burst.h"
+#include "encode.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct session {
+    enum session_role role;
+    enum session_state state;
+    int rx, tx;                 // channels
+
+    size_t frame;               // frames processed
+    size_t entered;             // frame at which `state' was entered
+    size_t detect;              // frames of carrier that count as a carrier
+    size_t timeout;             // frames to wait for carrier
+
+    struct audio_state as;
+    struct stream_state *sd;
+    struct burst_scan *carrier;
+    struct encode_stream *enc;
+
+    void *userdata;
+    streamdecode_callback *cb;
+    session_state_callback *scb;
+};
+
+static int ignore_burst(void *userdata, const struct burst *b)
+{
+    (void)userdata;
+    (void)b;
+    return 0;
+}
+
+static int session_emit(void *userdata, int status, int data)
+{
+    struct session *s = userdata;
+    if (s->state != SESSION_TRAINING && s->state != SESSION_CONNECTED)
+        return 0;
+
+    return s->cb(s->userdata, status, data);
+}
+
+static enum encode_stream_mode transmit_mode(const struct session *s)
+{
+    switch (s->state) {
+        case SESSION_WAITING:
+            // the answering side's carrier is what the originating side
+            // waits for
+            return s->role == SESSION_ANSWER ? ENCODE_STREAM_MARK : ENCODE_STREAM_SILENT;
+        case SESSION_TRAINING:
+            return ENCODE_STREAM_MARK;
+        case SESSION_CONNECTED:
+            return ENCODE_STREAM_DATA;
+        default:
+            return ENCODE_STREAM_SILENT;
+    }
+}
+
+static void enter(struct session *s, enum session_state state)
+{
+    s->state = state;
+    s->entered = s->frame;
+    encode_stream_set_mode(s->enc, transmit_mode(s));
+
+    if (s->scb)
+        s->scb(s->userdata, state);
+}
+
+int session_init(struct session **sp, const struct audio_state *as, enum session_role role,
+                 double gain, size_t queue, void *ud, streamdecode_callback *cb,
+                 session_state_callback *scb)
+{
+    struct session *s = *sp = calloc(1, sizeof *s);
+    if (!s)
+        return -1;
+
+    memcpy(&s->as, as, sizeof *as);
+    s->role     = role;
+    s->tx       = role == SESSION_ORIGINATE ? 0 : 1;
+    s->rx       = !s->tx;
+    s->detect   = (size_t)as->sample_rate * SESSION_DETECT_MS / 1000;
+    s->timeout  = (size_t)as->sample_rate * SESSION_TIMEOUT_MS / 1000;
+    s->userdata = ud;
+    s->cb       = cb;
+    s->scb      = scb;
+
+    struct encode_state es = {
+        .channel = s->tx,
+        .gain    = gain,
+    };
+    memcpy(&es.audio, as, sizeof *as);
+
+    if (streamdecode_init(&s->sd, &s->as, s, session_emit, s->rx))
+        goto error;
+    if (burst_scan_init(&s->carrier, &s->as, s, ignore_burst))
+        goto error;
+    if (encode_stream_init(&s->enc, &es, queue))
+        goto error;
+
+    s->state = SESSION_WAITING;
+    encode_stream_set_mode(s->enc, transmit_mode(s));
+
+    return 0;
+error:
+    session_fini(s);
+    *sp = NULL;
+    return -1;
+}
+
+// moves through the handshake on what has been heard so far
+static void advance(struct session *s)
+{
+    size_t heard;
+    const int carrier = burst_scan_carrier(s->carrier, s->rx, &heard);
+    const size_t since = s->frame - s->entered;
+
+    switch (s->state) {
+        case SESSION_WAITING:
+            if (carrier && heard >= s->detect)
+                enter(s, s->role == SESSION_ANSWER ? SESSION_CONNECTED : SESSION_TRAINING);
+            else if (since >= s->timeout)
+                enter(s, SESSION_TIMEOUT);
+            break;
+        case SESSION_TRAINING:
+            // give the answering side time to hear us before sending data
+            if (!carrier)
+                enter(s, SESSION_LOST);
+            else if (since >= 2 * s->detect)
+                enter(s, SESSION_CONNECTED);
+            break;
+        case SESSION_CONNECTED:
+            if (!carrier)
+                enter(s, SESSION_LOST);
+            break;
+        default:
+            break;
+    }
+}
+
+int session_process(struct session *s, size_t count, const double in[count], double out[count])
+{
+    int rc = 0;
+
+    if (burst_scan_process(s->carrier, count, in))
+        rc = -1;
+    if (streamdecode_process(s->sd, count, in))
+        rc = -1;
+
+    s->frame += count;
+    advance(s);
+
+    encode_stream_fill(s->enc, count, out);
+
+    return rc;
+}
+
+size_t session_send(struct session *s, size_t count, const unsigned char bytes[count])
+{
+    return encode_stream_queue(s->enc, count, bytes);
+}
+
+int session_busy(struct session *s)
+{
+    return encode_stream_busy(s->enc);
+}
+
+enum session_state session_state(struct session *s)
+{
+    return s->state;
+}
+
+const char *session_state_name(enum session_state state)
+{
+    static const char *names[SESSION_max] = {
+        [SESSION_WAITING]   = "waiting",
+        [SESSION_TRAINING]  = "training",
+        [SESSION_CONNECTED] = "connected",
+        [SESSION_LOST]      = "lost",
+        [SESSION_TIMEOUT]   = "timeout",
+    };
+
+    return state < SESSION_max ? names[state] : "invalid";
+}
+
+void session_fini(struct session *s)
+{
+    if (s->enc)
+        encode_stream_fini(s->enc);
+    if (s->carrier)
+        burst_scan_fini(s->carrier);
+    if (s->sd)
+        streamdecode_fini(s->sd);
+    free(s);
+}
+
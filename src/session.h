@@ -0,0 +1,67 @@
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include "tynsel_api.h"
+
+#include "streamdecode.h"
+
+#include <stddef.h>
+
+struct audio_state;
+
+// A full-duplex modem session : a modulator on one channel and a decoder on
+// the other, driven together one frame of audio at a time. The originating
+// side transmits on channel 0 and listens on channel 1, the answering side
+// the reverse. Everything is allocated up front, so session_process never
+// allocates and takes time proportional to the frame.
+//
+// The handshake follows Bell 103 : the answering side sends mark carrier at
+// once ; the originating side stays silent until it has heard that carrier
+// for SESSION_DETECT_MS, then answers with its own. Each side counts as
+// connected once it has heard the other's carrier long enough, and the
+// originating side waits a little longer still so that its first character
+// reaches an answering side that is already listening. Losing carrier ends
+// the session.
+struct session;
+
+enum session_role {
+    SESSION_ORIGINATE,
+    SESSION_ANSWER,
+};
+
+enum session_state {
+    SESSION_WAITING,    // for the other side's carrier
+    SESSION_TRAINING,   // carrier heard ; sending mark, not yet data
+    SESSION_CONNECTED,  // sending queued data
+    SESSION_LOST,       // carrier went away after training began
+    SESSION_TIMEOUT,    // no carrier within SESSION_TIMEOUT_MS
+
+    SESSION_max
+};
+
+#define SESSION_DETECT_MS   150
+#define SESSION_TIMEOUT_MS  10000
+
+// called from session_process whenever the state changes
+typedef void session_state_callback(void *userdata, enum session_state state);
+
+// `cb' receives decoded characters as from streamdecode, but only while
+// training or connected ; `queue' is the number of bytes that can wait to be
+// sent
+TYNSEL_API int session_init(struct session **sp, const struct audio_state *as, enum session_role role,
+                            double gain, size_t queue, void *ud, streamdecode_callback *cb,
+                            session_state_callback *scb);
+// decodes `in' and fills `out' with the same number of samples to send ;
+// returns -1 if the decoder reported an error
+TYNSEL_API int session_process(struct session *s, size_t count, const double in[count], double out[count]);
+// never blocks, and may be called from another thread than session_process ;
+// returns the number of bytes queued, which are held until connected
+TYNSEL_API size_t session_send(struct session *s, size_t count, const unsigned char bytes[count]);
+// whether any byte is still queued or being sent
+TYNSEL_API int session_busy(struct session *s);
+TYNSEL_API enum session_state session_state(struct session *s);
+TYNSEL_API const char *session_state_name(enum session_state state);
+TYNSEL_API void session_fini(struct session *s);
+
+#endif
+
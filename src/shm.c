@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+
+#include "shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define SHM_ALIGN 64
+
+_Static_assert(sizeof(struct shm_ring) == 192, "shm_ring layout");
+_Static_assert(offsetof(struct shm_ring, head) == 64, "shm_ring layout");
+_Static_assert(offsetof(struct shm_ring, tail) == 128, "shm_ring layout");
+_Static_assert(offsetof(struct shm_header, audio) == 64, "shm_header layout");
+_Static_assert(sizeof(struct shm_header) == 448, "shm_header layout");
+_Static_assert(sizeof(struct shm_result) == 16, "shm_result layout");
+
+struct shm_segment {
+    struct shm_header *h;
+    size_t len;
+    char *name;
+};
+
+#ifdef __linux__
+// Not FUTEX_PRIVATE_FLAG : the waiter and the waker are in different processes.
+static void futex_wait(uint32_t *word, uint32_t val, int timeout_ms)
+{
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+#else
+// without futexes, waiters poll every millisecond
+static void futex_wait(uint32_t *word, uint32_t val, int timeout_ms)
+{
+    struct timespec ts = { 0, 1000000L };
+    for (int i = 0; i < timeout_ms && __atomic_load_n(word, __ATOMIC_ACQUIRE) == val; i++)
+        nanosleep(&ts, NULL);
+}
+
+static void futex_wake(uint32_t *word)
+{
+    (void)word;
+}
+#endif
+
+static size_t pow2(size_t count)
+{
+    size_t size = 1;
+    while (size < count)
+        size <<= 1;
+    return size;
+}
+
+static size_t align_up(size_t n)
+{
+    return (n + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+}
+
+static void ring_setup(struct shm_ring *r, size_t capacity, size_t elem_size, size_t offset)
+{
+    r->capacity    = capacity;
+    r->elem_size   = elem_size;
+    r->data_offset = offset;
+}
+
+static struct shm_ring_ref ring_ref(struct shm_segment *s, struct shm_ring *r)
+{
+    return (struct shm_ring_ref){ .r = r, .data = (unsigned char *)s->h + r->data_offset };
+}
+
+static int segment_map(struct shm_segment **sp, const char *name, int fd, size_t len)
+{
+    struct shm_segment *s = calloc(1, sizeof *s);
+    if (!s)
+        return -1;
+
+    s->h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    s->name = strdup(name);
+    if (s->h == MAP_FAILED || !s->name) {
+        int e = errno;
+        if (s->h != MAP_FAILED)
+            munmap(s->h, len);
+        free(s->name);
+        free(s);
+        errno = e;
+        return -1;
+    }
+    s->len = len;
+
+    *sp = s;
+    return 0;
+}
+
+int shm_segment_create(struct shm_segment **sp, const char *name, unsigned rate,
+        enum pcm_format format, unsigned channels, size_t frames, size_t results)
+{
+    const size_t sample_size = pcm_format_size(format);
+    if (!sample_size || channels == 0 || frames == 0 || results == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    frames  = pow2(frames);
+    results = pow2(results);
+    const size_t frame_size = sample_size * channels;
+    const size_t audio_at   = align_up(sizeof(struct shm_header));
+    const size_t results_at = align_up(audio_at + frames * frame_size);
+    const size_t len        = results_at + results * sizeof(struct shm_result);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, len) || segment_map(sp, name, fd, len)) {
+        int e = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = e;
+        return -1;
+    }
+    close(fd);
+
+    // ftruncate zeroed everything, indices and flags included
+    struct shm_header *h = (*sp)->h;
+    h->version     = SHM_VERSION;
+    h->sample_rate = rate;
+    h->format      = format;
+    h->channels    = channels;
+    ring_setup(&h->audio, frames, frame_size, audio_at);
+    ring_setup(&h->results, results, sizeof(struct shm_result), results_at);
+
+    // the magic goes in last, so an attaching process never sees a partial header
+    char magic[sizeof h->magic] = SHM_MAGIC;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(h->magic, magic, sizeof magic);
+
+    return 0;
+}
+
+static int ring_valid(const struct shm_ring *r, size_t len)
+{
+    return r->capacity && !(r->capacity & (r->capacity - 1)) && r->elem_size
+        && r->data_offset >= sizeof(struct shm_header)
+        && r->data_offset <= len
+        && r->capacity <= (len - r->data_offset) / r->elem_size;
+}
+
+int shm_segment_attach(struct shm_segment **sp, const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct shm_header)) {
+        close(fd);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    int rc = segment_map(sp, name, fd, st.st_size);
+    close(fd);
+    if (rc)
+        return -1;
+
+    struct shm_segment *s = *sp;
+    const struct shm_header *h = s->h;
+    char magic[sizeof h->magic] = SHM_MAGIC;
+    if (memcmp(h->magic, magic, sizeof magic)) {
+        // a creator that is still setting up has written nothing yet
+        static const char none[sizeof h->magic];
+        rc = memcmp(h->magic, none, sizeof none) ? EINVAL : EAGAIN;
+    } else {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (h->version != SHM_VERSION || !pcm_format_size(h->format) || !h->channels
+                || h->audio.elem_size != pcm_format_size(h->format) * h->channels
+                || h->results.elem_size != sizeof(struct shm_result)
+                || !ring_valid(&h->audio, s->len) || !ring_valid(&h->results, s->len))
+            rc = EINVAL;
+    }
+    if (rc) {
+        shm_segment_close(s, 0);
+        *sp = NULL;
+        errno = rc;
+        return -1;
+    }
+
+    return 0;
+}
+
+const struct shm_header *shm_segment_header(struct shm_segment *s)
+{
+    return s->h;
+}
+
+struct shm_ring_ref shm_segment_audio(struct shm_segment *s)
+{
+    return ring_ref(s, &s->h->audio);
+}
+
+struct shm_ring_ref shm_segment_results(struct shm_segment *s)
+{
+    return ring_ref(s, &s->h->results);
+}
+
+void shm_segment_close(struct shm_segment *s, int unlink)
+{
+    if (!s)
+        return;
+    if (unlink)
+        shm_unlink(s->name);
+    munmap(s->h, s->len);
+    free(s->name);
+    free(s);
+}
+
+size_t shm_ring_reserve(struct shm_ring_ref *ref, void **elems)
+{
+    struct shm_ring *r = ref->r;
+    const uint64_t head = r->head;
+    const uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    const uint64_t at   = head & (r->capacity - 1);
+    uint64_t n = r->capacity - (head - tail);
+    if (n > r->capacity - at)
+        n = r->capacity - at;
+
+    *elems = ref->data + at * r->elem_size;
+    return n;
+}
+
+void shm_ring_commit(struct shm_ring_ref *ref, size_t count)
+{
+    struct shm_ring *r = ref->r;
+    __atomic_store_n(&r->head, r->head + count, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&r->head_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->data_waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&r->head_seq);
+}
+
+void shm_ring_close(struct shm_ring_ref *ref)
+{
+    struct shm_ring *r = ref->r;
+    __atomic_store_n(&r->closed, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&r->head_seq, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&r->head_seq);
+}
+
+size_t shm_ring_peek(struct shm_ring_ref *ref, const void **elems)
+{
+    struct shm_ring *r = ref->r;
+    const uint64_t tail = r->tail;
+    const uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    const uint64_t at   = tail & (r->capacity - 1);
+    uint64_t n = head - tail;
+    if (n > r->capacity - at)
+        n = r->capacity - at;
+
+    *elems = ref->data + at * r->elem_size;
+    return n;
+}
+
+void shm_ring_release(struct shm_ring_ref *ref, size_t count)
+{
+    struct shm_ring *r = ref->r;
+    __atomic_store_n(&r->tail, r->tail + count, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&r->tail_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->space_waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&r->tail_seq);
+}
+
+// Setting the waiting flag before the second look at the sequence word pairs
+// with the other side bumping the word before it looks at the flag : either
+// the sleeper sees the new value and does not sleep, or the other side sees
+// the flag and wakes it.
+static void wait_on(uint32_t *word, uint32_t *waiting, uint32_t seq, int timeout_ms)
+{
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == seq)
+        futex_wait(word, seq, timeout_ms);
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+int shm_ring_wait_data(struct shm_ring_ref *ref, int timeout_ms)
+{
+    struct shm_ring *r = ref->r;
+    const uint32_t seq = __atomic_load_n(&r->head_seq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != r->tail)
+        return 1;
+    if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE))
+        return -1;
+
+    wait_on(&r->head_seq, &r->data_waiting, seq, timeout_ms);
+
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != r->tail)
+        return 1;
+    return __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE) ? -1 : 0;
+}
+
+int shm_ring_wait_space(struct shm_ring_ref *ref, int timeout_ms)
+{
+    struct shm_ring *r = ref->r;
+    const uint32_t seq = __atomic_load_n(&r->tail_seq, __ATOMIC_SEQ_CST);
+    if (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) < r->capacity)
+        return 1;
+
+    wait_on(&r->tail_seq, &r->space_waiting, seq, timeout_ms);
+
+    return r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) < r->capacity;
+}
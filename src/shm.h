@@ -0,0 +1,137 @@
+#ifndef SHM_H_
+#define SHM_H_
+
+#include "io.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A POSIX shared-memory segment through which another process hands audio to
+// a decoder without going through a pipe or socket, and gets the decoded
+// characters back. The segment holds two single-producer single-consumer
+// rings : `audio', of interleaved PCM frames written by the capturing process
+// and read by the decoder, and `results', of struct shm_result written by the
+// decoder and read by the capturing process. Both sides work on the elements
+// in place in the mapping.
+//
+// The layout is fixed so that programs not using this code can take part :
+// all fields are in host byte order, and all offsets are from the start of
+// the segment.
+//
+//   offset  size  field
+//        0     8  magic "TYNSHM1\0", written last by the creator
+//        8     4  version (SHM_VERSION)
+//       12     4  sample_rate
+//       16     4  format, an enum pcm_format (0 u8, 1 s16, 2 s32, 3 f32, 4 f64)
+//       20     4  channels
+//       24    40  reserved, zero
+//       64   192  audio ring header (below)
+//      256   192  results ring header
+//      448        element storage, each ring's at its data_offset
+//
+// and each ring header, three cache lines so that neither side's writes
+// invalidate the line the other side writes :
+//
+//   offset  size  field
+//        0     8  capacity, in elements, a power of two
+//        8     8  elem_size, in bytes
+//       16     8  data_offset of element 0
+//       24    40  reserved
+//       64     8  head : elements ever written ; written by the producer
+//       72     4  head_seq : futex word, bumped after head moves or on close
+//       76     4  closed : nonzero once the producer has finished
+//       80     4  data_waiting : nonzero while the consumer sleeps on head_seq
+//       84    44  reserved
+//      128     8  tail : elements ever read ; written by the consumer
+//      136     4  tail_seq : futex word, bumped after tail moves
+//      140     4  space_waiting : nonzero while the producer sleeps on tail_seq
+//      144    48  reserved
+//
+// Element i lives at data_offset + (i mod capacity) * elem_size. A producer
+// writes elements, stores head with release semantics, increments head_seq
+// and, if data_waiting is set, wakes head_seq (FUTEX_WAKE, not private). A
+// consumer that finds the ring empty reads head_seq, sets data_waiting,
+// checks head_seq again and sleeps on it (FUTEX_WAIT) ; the direction from
+// consumer to producer mirrors this with tail, tail_seq and space_waiting.
+// The sleeps are bounded, so a peer that dies only costs a timeout.
+
+#define SHM_MAGIC   "TYNSHM1"
+#define SHM_VERSION 1
+
+struct shm_ring {
+    uint64_t capacity;
+    uint64_t elem_size;
+    uint64_t data_offset;
+    uint8_t reserved0[40];
+
+    uint64_t head;
+    uint32_t head_seq;
+    uint32_t closed;
+    uint32_t data_waiting;
+    uint8_t reserved1[44];
+
+    uint64_t tail;
+    uint32_t tail_seq;
+    uint32_t space_waiting;
+    uint8_t reserved2[48];
+};
+
+struct shm_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t format;
+    uint32_t channels;
+    uint8_t reserved[40];
+
+    struct shm_ring audio;
+    struct shm_ring results;
+};
+
+// a decoded character, or an error, as streamdecode_callback reports it
+struct shm_result {
+    uint64_t offset;        // audio frame that completed the character
+    int32_t status;
+    int32_t data;
+};
+
+struct shm_segment;
+
+// one side's handle on one ring of a mapped segment
+struct shm_ring_ref {
+    struct shm_ring *r;
+    unsigned char *data;
+};
+
+// creates and maps segment `name' (as for shm_open), failing with EEXIST if
+// it is already there ; `frames' and `results' are rounded up to powers of two
+int shm_segment_create(struct shm_segment **sp, const char *name, unsigned rate,
+        enum pcm_format format, unsigned channels, size_t frames, size_t results);
+// maps an existing segment, failing with EAGAIN if its creator has not
+// finished setting it up, or EINVAL if it is not a segment of this version
+int shm_segment_attach(struct shm_segment **sp, const char *name);
+const struct shm_header *shm_segment_header(struct shm_segment *s);
+struct shm_ring_ref shm_segment_audio(struct shm_segment *s);
+struct shm_ring_ref shm_segment_results(struct shm_segment *s);
+// unmaps the segment, and removes its name if `unlink' is set
+void shm_segment_close(struct shm_segment *s, int unlink);
+
+// Producer side : shm_ring_reserve gives the free elements that follow each
+// other in memory at the head, possibly fewer than are free in all, for
+// filling in place ; shm_ring_commit publishes the first `count' of them.
+size_t shm_ring_reserve(struct shm_ring_ref *ref, void **elems);
+void shm_ring_commit(struct shm_ring_ref *ref, size_t count);
+// marks the end of the data ; the consumer still gets what was committed
+void shm_ring_close(struct shm_ring_ref *ref);
+
+// Consumer side, likewise : shm_ring_peek gives the contiguous elements at
+// the tail, and shm_ring_release frees the first `count' of them.
+size_t shm_ring_peek(struct shm_ring_ref *ref, const void **elems);
+void shm_ring_release(struct shm_ring_ref *ref, size_t count);
+
+// sleep up to `timeout_ms' for data (or for space) ; return 1 if there is
+// some, 0 on timeout, and -1 if the ring is closed and drained
+int shm_ring_wait_data(struct shm_ring_ref *ref, int timeout_ms);
+int shm_ring_wait_space(struct shm_ring_ref *ref, int timeout_ms);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2012-2014 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+// Decodes audio that another process writes into a shared-memory segment (see
+// shm.h), straight from the mapping, and hands each character back through
+// the segment's results ring. Runs until the producer closes the audio ring.
+
+#define _XOPEN_SOURCE 600
+
+#include "shm.h"
+#include "streamdecode.h"
+#include "audio.h"
+#include "io.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// how long a wait lasts before looking for signals again
+#define WAIT_MS 100
+// how long to hold a character for a reader that has stopped draining results
+#define RESULT_WAIT_MS 1000
+// frames converted at a time from formats other than mono f64
+#define CONVERT_FRAMES 1024
+
+struct shmdecode_opts {
+    unsigned wait;          // seconds to wait for the segment to appear
+    int line;               // which interleaved channel to decode
+};
+
+struct decoder {
+    struct stream_state *sd;
+    struct shm_ring_ref results;
+    unsigned long long frames;  // frames decoded before the current block
+    unsigned long chars, dropped;
+};
+
+static volatile sig_atomic_t quit;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+static int publish(void *userdata, int status, int data)
+{
+    struct decoder *d = userdata;
+    // the tick wraps, but never by more than a block behind `frames'
+    const unsigned tick = streamdecode_tick(d->sd);
+    const struct shm_result res = {
+        .offset = d->frames + (unsigned)(tick - (unsigned)d->frames),
+        .status = status,
+        .data   = data,
+    };
+
+    void *slot;
+    while (!shm_ring_reserve(&d->results, &slot)) {
+        if (quit || shm_ring_wait_space(&d->results, RESULT_WAIT_MS) == 0) {
+            d->dropped++;
+            return 0;
+        }
+    }
+    memcpy(slot, &res, sizeof res);
+    shm_ring_commit(&d->results, 1);
+    d->chars++;
+
+    return 0;
+}
+
+static int parse_opts(struct shmdecode_opts *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "w:l:")) != -1) {
+        switch (ch) {
+            case 'w': o->wait = strtol(optarg, NULL, 0); break;
+            case 'l': o->line = strtol(optarg, NULL, 0); break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        fprintf(stderr, "Supply channel number and segment name\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int attach(struct shm_segment **sp, const char *name, unsigned wait)
+{
+    const struct timespec pause = { 0, WAIT_MS * 1000000L };
+    for (unsigned waited = 0; ; waited += WAIT_MS) {
+        if (!shm_segment_attach(sp, name))
+            return 0;
+        if ((errno != ENOENT && errno != EAGAIN) || waited >= wait * 1000 || quit)
+            return -1;
+        nanosleep(&pause, NULL);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct shmdecode_opts opts = {
+        .wait = 10,
+        .line = 0,
+    };
+    if (parse_opts(&opts, argc, argv))
+        return EXIT_FAILURE;
+
+    const int channel = strtol(argv[optind], NULL, 0);
+    const char *name = argv[optind + 1];
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    struct shm_segment *seg;
+    if (attach(&seg, name, opts.wait)) {
+        fprintf(stderr, "Failed to attach to `%s' : %s\n", name, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    const struct shm_header *h = shm_segment_header(seg);
+    if (opts.line < 0 || (unsigned)opts.line >= h->channels) {
+        fprintf(stderr, "Segment `%s' has only %u channels\n", name, h->channels);
+        shm_segment_close(seg, 0);
+        return EXIT_FAILURE;
+    }
+
+    struct audio_state as = {
+        .sample_rate = h->sample_rate,
+        .baud_rate   = 300,
+        .start_bits  = 1,
+        .data_bits   = 7,
+        .parity_bits = 1,
+        .stop_bits   = 2,
+        .freqs       = bell103_freqs,
+    };
+
+    struct shm_ring_ref audio = shm_segment_audio(seg);
+    struct decoder d = { .results = shm_segment_results(seg) };
+    if (streamdecode_init(&d.sd, &as, &d, publish, channel)) {
+        fprintf(stderr, "Failed to set up the decoder\n");
+        shm_segment_close(seg, 0);
+        return EXIT_FAILURE;
+    }
+
+    // mono doubles are exactly what the decoder takes, so it reads the ring
+    // itself ; anything else goes through a small conversion buffer
+    const int direct = h->format == PCM_DOUBLE && h->channels == 1;
+    struct pcm_view v = {
+        .rate       = h->sample_rate,
+        .channels   = h->channels,
+        .format     = h->format,
+        .frame_size = h->audio.elem_size,
+    };
+    double buf[CONVERT_FRAMES];
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int rc = 0;
+    while (!quit && !rc) {
+        const void *p;
+        size_t n = shm_ring_peek(&audio, &p);
+        if (!n) {
+            if (shm_ring_wait_data(&audio, WAIT_MS) < 0)
+                break;
+            continue;
+        }
+
+        if (direct) {
+            rc = streamdecode_process(d.sd, n, p);
+            d.frames += n;
+        } else {
+            v.data   = p;
+            v.frames = n;
+            for (size_t off = 0; off < n && !rc; ) {
+                size_t got = pcm_read(&v, off, opts.line, CONVERT_FRAMES, buf);
+                rc = streamdecode_process(d.sd, got, buf);
+                d.frames += got;
+                off += got;
+            }
+        }
+
+        shm_ring_release(&audio, n);
+    }
+
+    shm_ring_close(&d.results);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    const double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "decoded %llu frames in %.3f s (%.1f x real time), %lu characters, %lu dropped\n",
+            d.frames, secs, secs > 0 ? d.frames / (secs * h->sample_rate) : 0., d.chars, d.dropped);
+
+    streamdecode_fini(d.sd);
+    shm_segment_close(seg, 0);
+
+    return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
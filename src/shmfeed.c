@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2012-2014 Darren Kulp
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+// Feeds an audio file through a shared-memory segment (see shm.h) to a
+// decoder in another process, such as shmdecode, and prints the characters
+// that come back, for checking and benchmarking the shared-memory path.
+// Samples go from libsndfile straight into the ring.
+
+#define _XOPEN_SOURCE 600
+
+#include "shm.h"
+#include "streamdecode.h"
+#include "io.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sndfile.h>
+
+#define WAIT_MS 100
+
+// a decoder taken from the ring, the progress it was last seen to make
+struct progress {
+    uint64_t tail;          // audio frames it had read
+    unsigned long chars;    // results it had sent back
+    struct timespec at;
+};
+
+struct shmfeed_opts {
+    const char *name;
+    enum pcm_format format; // of the samples in the ring
+    size_t block;           // most frames committed at a time
+    size_t capacity;        // frames the ring holds
+    int paced;              // feed in real time rather than as fast as possible
+    int timestamps;         // print the frame that completed each character
+    unsigned wait;          // seconds the decoder may go without progress
+};
+
+static volatile sig_atomic_t quit;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+static unsigned long drain(struct shm_ring_ref *results, int timestamps)
+{
+    unsigned long count = 0;
+    const void *p;
+    size_t n;
+    while ((n = shm_ring_peek(results, &p))) {
+        const struct shm_result *r = p;
+        for (size_t i = 0; i < n; i++) {
+            switch (r[i].status) {
+                case STREAM_ERR_OK:
+                    printf("char '%c' (%d)", r[i].data, r[i].data);
+                    break;
+                case STREAM_ERR_PARITY:
+                    printf("char '%c' (%d) (PARITY FAILED)", r[i].data, r[i].data);
+                    break;
+                default:
+                    printf("unknown error");
+                    break;
+            }
+            if (timestamps)
+                printf(" at %llu", (unsigned long long)r[i].offset);
+            putchar('\n');
+        }
+        shm_ring_release(results, n);
+        count += n;
+    }
+
+    return count;
+}
+
+// Whether the decoder has made no progress, reading audio or sending back
+// results, for `wait' seconds : one that never attached, or has died, would
+// otherwise be waited on for ever
+static int stalled(struct progress *p, const struct shm_ring_ref *audio,
+        unsigned long chars, unsigned wait)
+{
+    const uint64_t tail = __atomic_load_n(&audio->r->tail, __ATOMIC_ACQUIRE);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (tail != p->tail || chars != p->chars) {
+        *p = (struct progress){ .tail = tail, .chars = chars, .at = now };
+        return 0;
+    }
+
+    return (now.tv_sec - p->at.tv_sec) + (now.tv_nsec - p->at.tv_nsec) / 1e9 >= wait;
+}
+
+static size_t read_frames(SNDFILE *sf, enum pcm_format format, void *at, size_t count)
+{
+    switch (format) {
+        case PCM_S16:    return sf_readf_short (sf, at, count);
+        case PCM_S32:    return sf_readf_int   (sf, at, count);
+        case PCM_FLOAT:  return sf_readf_float (sf, at, count);
+        case PCM_DOUBLE: return sf_readf_double(sf, at, count);
+        default:         return 0;
+    }
+}
+
+static void pace(const struct timespec *start, unsigned long long frames, unsigned rate)
+{
+    const unsigned long long ns = frames * 1000000000ULL / rate;
+    struct timespec until = {
+        .tv_sec  = start->tv_sec + (start->tv_nsec + ns) / 1000000000ULL,
+        .tv_nsec = (start->tv_nsec + ns) % 1000000000ULL,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR && !quit)
+        ;
+}
+
+static int parse_opts(struct shmfeed_opts *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "n:f:b:c:w:pt")) != -1) {
+        switch (ch) {
+            case 'n': o->name       = optarg;                  break;
+            case 'b': o->block      = strtol(optarg, NULL, 0); break;
+            case 'c': o->capacity   = strtol(optarg, NULL, 0); break;
+            case 'w': o->wait       = strtol(optarg, NULL, 0); break;
+            case 'p': o->paced      = 1;                       break;
+            case 't': o->timestamps = 1;                       break;
+            case 'f':
+                if (pcm_format_parse(optarg, &o->format) || o->format == PCM_U8) {
+                    fprintf(stderr, "Unsupported sample format `%s'\n", optarg);
+                    return -1;
+                }
+                break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Supply an input filename (`-' for stdin)\n");
+        return -1;
+    }
+    if (o->block == 0 || o->capacity == 0) {
+        fprintf(stderr, "Block size and capacity must be positive\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct shmfeed_opts opts = {
+        .name     = "/tynsel",
+        .format   = PCM_DOUBLE,
+        .block    = 1024,
+        .capacity = 1 << 16,
+        .wait     = 5,
+    };
+    if (parse_opts(&opts, argc, argv))
+        return EXIT_FAILURE;
+
+    const char *filename = argv[optind];
+    SF_INFO sinfo = { .format = 0 };
+    SNDFILE *sf = !strcmp(filename, "-")
+        ? sf_open_fd(STDIN_FILENO, SFM_READ, &sinfo, 0)
+        : sf_open(filename, SFM_READ, &sinfo);
+    if (!sf) {
+        fprintf(stderr, "Failed to open `%s' for reading : %s\n", filename, sf_strerror(NULL));
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    struct shm_segment *seg;
+    if (shm_segment_create(&seg, opts.name, sinfo.samplerate, opts.format,
+                           sinfo.channels, opts.capacity, 1024)) {
+        fprintf(stderr, "Failed to create `%s' : %s\n", opts.name, strerror(errno));
+        sf_close(sf);
+        return EXIT_FAILURE;
+    }
+
+    struct shm_ring_ref audio = shm_segment_audio(seg);
+    struct shm_ring_ref results = shm_segment_results(seg);
+    unsigned long long frames = 0;
+    unsigned long chars = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct progress progress = { .at = start };
+
+    int eof = 0, gone = 0;
+    while (!eof && !quit && !gone) {
+        chars += drain(&results, opts.timestamps);
+
+        void *at;
+        size_t n = shm_ring_reserve(&audio, &at);
+        if (!n) {
+            // the decoder has fallen behind (or has yet to attach)
+            shm_ring_wait_space(&audio, WAIT_MS);
+            gone = stalled(&progress, &audio, chars, opts.wait);
+            continue;
+        }
+        if (n > opts.block)
+            n = opts.block;
+
+        size_t got = read_frames(sf, opts.format, at, n);
+        shm_ring_commit(&audio, got);
+        frames += got;
+        eof = got < n;
+
+        if (opts.paced)
+            pace(&start, frames, sinfo.samplerate);
+    }
+    shm_ring_close(&audio);
+
+    // the decoder closes the results ring once it has seen all of the audio
+    while (!quit && !gone) {
+        chars += drain(&results, opts.timestamps);
+        if (shm_ring_wait_data(&results, WAIT_MS) < 0)
+            break;
+        gone = stalled(&progress, &audio, chars, opts.wait);
+    }
+    if (gone)
+        fprintf(stderr, "No progress from the decoder in %u s, giving up\n", opts.wait);
+    chars += drain(&results, opts.timestamps);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    const double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "fed %llu frames in %.3f s (%.1f x real time), %lu characters back\n",
+            frames, secs, secs > 0 ? frames / (secs * sinfo.samplerate) : 0., chars);
+
+    shm_segment_close(seg, 1);
+    sf_close(sf);
+
+    return quit || gone ? EXIT_FAILURE : EXIT_SUCCESS;
+}
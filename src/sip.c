@@ -21,13 +21,529 @@
 #define PJMEDIA_CONF_USE_SWITCH_BOARD 1
 #include <pjsua-lib/pjsua.h>
 
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+#include "encode.h"
+#include "hist.h"
+#include "streamdecode.h"
+#include "livedecode.h"
+
 #define THIS_FILE       "APP"
 
-struct mydata {
-    pjsua_conf_port_id play_port;
-    pjsua_conf_port_id rec_port;
+// seconds of audio the decoder may fall behind the media thread
+#define DECODE_QUEUE_SECONDS 2
+// bytes that may wait to be sent
+#define SEND_QUEUE_BYTES 4096
+#define DEFAULT_MAX_CALLS 8
+// received frames whose arrival times are kept, for timing characters
+#define ARRIVAL_LOG 64
+#define DEFAULT_STATS_INTERVAL 5
+
+struct call_slot;
+
+/*
+ * Counters for one call. The media thread writes the frame counters and
+ * timings, the decoder thread the character counters ; the stats writer
+ * reads both while the call runs.
+ */
+struct call_metrics {
+    struct timespec start;
+
+    unsigned long long frames_in, frames_out;
+    unsigned accepted;          // samples handed to the decoder, modulo 2^32
+    size_t max_depth;           // most samples ever waiting for the decoder
+    struct hist put_ns, get_ns; // time spent in put_frame and get_frame
+    struct arrival {
+        unsigned end;           // `accepted' after the frame
+        unsigned long long ns;  // when the frame reached us
+    } arrivals[ARRIVAL_LOG];
+
+    unsigned long long chars, parity_errors;
+    // from the arrival of the frame that completed a character to its
+    // emission
+    struct hist latency_ns;
+};
+
+// what the stats writer reports for one call
+struct call_report {
+    unsigned index;
+    pjsua_call_id call;
+    double up;
+    unsigned long long frames_in, frames_out, chars, parity_errors;
+    size_t depth, max_depth;
+    unsigned long overruns, underruns;
+    struct hist put_ns, get_ns, latency_ns;
+};
+
+/*
+ * The modem side of one call : a decoder fed with the call's audio on its
+ * own thread, and a modulator rendering the audio we send.
+ */
+struct modem {
+    struct call_slot *slot;
+    struct audio_state as;
+    struct stream_state *sd;
+    struct live_decoder *live;
+    struct encode_stream *enc;
+    struct call_metrics metrics;
+    struct call_report report;  // the last word on the call, as it ends
 };
 
+/*
+ * A media port that connects a call to whichever modem is attached to it.
+ * The bridge calls put_frame and get_frame from the media thread, which only
+ * converts frames and queues or renders them ; decoding happens on the
+ * modem's own thread. Modems are attached and detached without ever making
+ * the media thread wait : it marks itself busy while it uses one, and
+ * detaching waits for that instead.
+ */
+struct modem_port {
+    pjmedia_port base;
+    unsigned channels;
+    struct modem *modem;    // NULL when idle
+    int busy;
+};
+
+/*
+ * Everything a call needs that outlives it : ports and their conference
+ * slots are created once at startup and recycled from call to call.
+ */
+struct call_slot {
+    unsigned index;
+    int in_use;
+    pjsua_call_id call;
+    pj_pool_t *pool;
+    struct modem_port *port;
+    pjsua_conf_port_id conf_id;
+    struct modem *modem;
+};
+
+struct server_opts {
+    unsigned max_calls;
+    unsigned port;
+    const char *greeting;   // sent at the start of every call
+    int echo;               // send back whatever is received
+    int daemon;             // no console ; run until signalled
+    int local;              // no registrar : take calls straight to our address
+    const char *stats_file; // rewritten every stats_interval seconds
+    unsigned stats_interval;
+};
+
+static struct server {
+    struct server_opts opts;
+    pjsua_media_config media_cfg;
+    pthread_mutex_t lock;   // protects slot assignment and the fields below
+    struct call_slot *slots;
+    unsigned long long total_calls, rejected_calls;
+
+    pthread_t stats_thread;
+    pthread_cond_t stats_cond;
+    int stats_done;
+} server;
+
+static volatile sig_atomic_t quit;
+
+static void on_signal(int sig)
+{
+    PJ_UNUSED_ARG(sig);
+    quit = 1;
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// times a character against the frame that completed it, if that frame is
+// still in the log
+static void time_character(struct modem *m)
+{
+    struct call_metrics *cm = &m->metrics;
+    const unsigned tick = streamdecode_tick(m->sd);
+    const unsigned long long now = now_ns();
+    const struct arrival *best = NULL;
+    unsigned best_ahead = 0;
+
+    for (unsigned i = 0; i < ARRIVAL_LOG; i++) {
+        const struct arrival *a = &cm->arrivals[i];
+        unsigned ahead = __atomic_load_n(&a->end, __ATOMIC_ACQUIRE) - tick;
+        // the frame holding `tick' is the one ending least far after it
+        if ((int)ahead >= 0 && (!best || ahead < best_ahead)) {
+            best = a;
+            best_ahead = ahead;
+        }
+    }
+
+    if (best) {
+        unsigned long long then = __atomic_load_n(&best->ns, __ATOMIC_RELAXED);
+        if (then && then <= now)
+            hist_add(&cm->latency_ns, now - then);
+    }
+}
+
+static int emit(void *userdata, int status, int data)
+{
+    struct modem *m = userdata;
+    struct call_metrics *cm = &m->metrics;
+    time_character(m);
+    __atomic_fetch_add(&cm->chars, 1, __ATOMIC_RELAXED);
+    if (status == STREAM_ERR_PARITY)
+        __atomic_fetch_add(&cm->parity_errors, 1, __ATOMIC_RELAXED);
+
+    // every call's decoder prints from its own thread, so each line goes out
+    // in one call
+    const unsigned index = m->slot->index;
+    switch (status) {
+        case STREAM_ERR_OK:
+            printf("call %u char '%c' (%d)\n", index, data, data);
+            break;
+        case STREAM_ERR_PARITY:
+            printf("call %u char '%c' (%d) (PARITY FAILED)\n", index, data, data);
+            break;
+        default:
+            printf("call %u unknown error\n", index);
+            break;
+    }
+    fflush(stdout);
+
+    // with echo on, this is the only thread queueing to the modulator
+    if (server.opts.echo && status == STREAM_ERR_OK) {
+        unsigned char c = data;
+        encode_stream_queue(m->enc, 1, &c);
+    }
+
+    return 0;
+}
+
+static struct modem *modem_create(struct call_slot *slot, unsigned rate, int tx_channel)
+{
+    struct modem *m = calloc(1, sizeof *m);
+    if (!m)
+        return NULL;
+
+    struct audio_state as = {
+        .sample_rate = rate,
+        .baud_rate   = 300,
+        .start_bits  = 1,
+        .data_bits   = 7,
+        .stop_bits   = 2,
+        .parity_bits = 1,
+        .freqs       = bell103_freqs,
+    };
+    memcpy(&m->as, &as, sizeof as);
+    m->slot = slot;
+    clock_gettime(CLOCK_MONOTONIC, &m->metrics.start);
+
+    struct encode_state s = {
+        .channel = tx_channel,
+        .gain    = 0.5,
+    };
+    memcpy(&s.audio, &as, sizeof as);
+
+    if (streamdecode_init(&m->sd, &m->as, m, emit, !tx_channel)) {
+        free(m);
+        return NULL;
+    }
+    if (livedecode_start(&m->live, m->sd, rate * DECODE_QUEUE_SECONDS)) {
+        streamdecode_fini(m->sd);
+        free(m);
+        return NULL;
+    }
+    if (encode_stream_init(&m->enc, &s, SEND_QUEUE_BYTES)) {
+        livedecode_stop(m->live);
+        streamdecode_fini(m->sd);
+        free(m);
+        return NULL;
+    }
+
+    if (server.opts.greeting)
+        encode_stream_queue(m->enc, strlen(server.opts.greeting),
+                            (const unsigned char *)server.opts.greeting);
+
+    return m;
+}
+
+static void metrics_snapshot(struct modem *m, struct call_report *r)
+{
+    const struct call_metrics *cm = &m->metrics;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    r->index         = m->slot->index;
+    r->call          = m->slot->call;
+    r->up            = (now.tv_sec - cm->start.tv_sec) + (now.tv_nsec - cm->start.tv_nsec) / 1e9;
+    r->frames_in     = __atomic_load_n(&cm->frames_in, __ATOMIC_RELAXED);
+    r->frames_out    = __atomic_load_n(&cm->frames_out, __ATOMIC_RELAXED);
+    r->chars         = __atomic_load_n(&cm->chars, __ATOMIC_RELAXED);
+    r->parity_errors = __atomic_load_n(&cm->parity_errors, __ATOMIC_RELAXED);
+    r->max_depth     = __atomic_load_n(&cm->max_depth, __ATOMIC_RELAXED);
+    r->depth         = livedecode_queued(m->live);
+    livedecode_counters(m->live, &r->overruns, &r->underruns);
+    hist_snapshot(&cm->put_ns, &r->put_ns);
+    hist_snapshot(&cm->get_ns, &r->get_ns);
+    hist_snapshot(&cm->latency_ns, &r->latency_ns);
+}
+
+static void print_hist(FILE *f, const char *name, const struct hist *h, double unit)
+{
+    fprintf(f, " %s %.1f/%.1f/%.1f/%.1f", name,
+               hist_percentile(h, 50) / unit, hist_percentile(h, 90) / unit,
+               hist_percentile(h, 99) / unit, h->max / unit);
+}
+
+// one line per call ; timings are p50/p90/p99/max
+static void metrics_print(FILE *f, const struct call_report *r)
+{
+    fprintf(f, "call %u id %d up %.1f rx_frames %llu tx_frames %llu",
+               r->index, r->call, r->up, r->frames_in, r->frames_out);
+    print_hist(f, "put_us", &r->put_ns, 1e3);
+    print_hist(f, "get_us", &r->get_ns, 1e3);
+    fprintf(f, " depth %zu max_depth %zu overruns %lu underruns %lu chars %llu parity_errors %llu",
+               r->depth, r->max_depth, r->overruns, r->underruns, r->chars, r->parity_errors);
+    print_hist(f, "latency_ms", &r->latency_ns, 1e6);
+    fputc('\n', f);
+}
+
+static void modem_destroy(struct modem *m)
+{
+    struct call_report *r = &m->report;
+    metrics_snapshot(m, r);
+    if (r->overruns)
+        PJ_LOG(2,(THIS_FILE, "Call %u decoder fell behind, dropped %lu samples",
+                             m->slot->index, r->overruns));
+
+    livedecode_stop(m->live);
+    // the final count includes characters decoded from the drained queue
+    r->chars         = m->metrics.chars;
+    r->parity_errors = m->metrics.parity_errors;
+    r->depth         = 0;
+    hist_snapshot(&m->metrics.latency_ns, &r->latency_ns);
+    // held across the parts of the line, against other calls' decoders
+    flockfile(stdout);
+    printf("ended ");
+    metrics_print(stdout, r);
+    fflush(stdout);
+    funlockfile(stdout);
+
+    streamdecode_fini(m->sd);
+    encode_stream_fini(m->enc);
+    free(m);
+}
+
+static struct modem *port_enter(struct modem_port *mp)
+{
+    __atomic_add_fetch(&mp->busy, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&mp->modem, __ATOMIC_SEQ_CST);
+}
+
+static void port_leave(struct modem_port *mp)
+{
+    __atomic_sub_fetch(&mp->busy, 1, __ATOMIC_RELEASE);
+}
+
+static void port_attach(struct modem_port *mp, struct modem *m)
+{
+    __atomic_store_n(&mp->modem, m, __ATOMIC_SEQ_CST);
+}
+
+static void port_detach(struct modem_port *mp)
+{
+    __atomic_store_n(&mp->modem, NULL, __ATOMIC_SEQ_CST);
+    // a media thread that saw the old modem is still between enter and leave
+    while (__atomic_load_n(&mp->busy, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+static pj_status_t modem_put_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    struct modem_port *mp = (struct modem_port *)this_port;
+    if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO || frame->size == 0)
+        return PJ_SUCCESS;
+
+    struct modem *m = port_enter(mp);
+    if (m) {
+        struct call_metrics *cm = &m->metrics;
+        const unsigned long long t0 = now_ns();
+        const pj_int16_t *in = frame->buf;
+        const size_t count = frame->size / sizeof *in / mp->channels;
+        double samples[count];
+        for (size_t i = 0; i < count; i++)
+            samples[i] = in[i * mp->channels] / 32768.;
+
+        // never waits ; if the decoder is that far behind, the frame is
+        // dropped and counted
+        size_t queued = livedecode_push(m->live, count, samples);
+
+        // only this thread writes these, so plain reads are fine
+        unsigned accepted = cm->accepted + queued;
+        struct arrival *a = &cm->arrivals[cm->frames_in % ARRIVAL_LOG];
+        __atomic_store_n(&cm->accepted, accepted, __ATOMIC_RELAXED);
+        __atomic_store_n(&a->ns, t0, __ATOMIC_RELAXED);
+        __atomic_store_n(&a->end, accepted, __ATOMIC_RELEASE);
+
+        size_t depth = livedecode_queued(m->live);
+        if (depth > cm->max_depth)
+            __atomic_store_n(&cm->max_depth, depth, __ATOMIC_RELAXED);
+        __atomic_store_n(&cm->frames_in, cm->frames_in + 1, __ATOMIC_RELAXED);
+        hist_add(&cm->put_ns, now_ns() - t0);
+    }
+    port_leave(mp);
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t modem_get_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    struct modem_port *mp = (struct modem_port *)this_port;
+    struct modem *m = port_enter(mp);
+    if (m) {
+        struct call_metrics *cm = &m->metrics;
+        const unsigned long long t0 = now_ns();
+        pj_int16_t *out = frame->buf;
+        const size_t count = this_port->info.samples_per_frame / mp->channels;
+        double samples[count];
+
+        encode_stream_fill(m->enc, count, samples);
+        for (size_t i = 0; i < count; i++) {
+            double x = samples[i] * 32767;
+            x = x > 32767 ? 32767 : x < -32768 ? -32768 : x;
+            for (unsigned c = 0; c < mp->channels; c++)
+                out[i * mp->channels + c] = (pj_int16_t)x;
+        }
+
+        frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+        frame->size = count * mp->channels * sizeof *out;
+
+        __atomic_store_n(&cm->frames_out, cm->frames_out + 1, __ATOMIC_RELAXED);
+        hist_add(&cm->get_ns, now_ns() - t0);
+    } else {
+        frame->type = PJMEDIA_FRAME_TYPE_NONE;
+        frame->size = 0;
+    }
+    port_leave(mp);
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t modem_on_destroy(pjmedia_port *this_port)
+{
+    PJ_UNUSED_ARG(this_port);
+    return PJ_SUCCESS;
+}
+
+static pj_status_t create_modem_port(pj_pool_t *pool, const pjsua_media_config *mcfg,
+                                     struct modem_port **p_port)
+{
+    struct modem_port *mp = PJ_POOL_ZALLOC_T(pool, struct modem_port);
+    const unsigned samples_per_frame =
+        mcfg->clock_rate * mcfg->audio_frame_ptime / 1000 * mcfg->channel_count;
+    pj_str_t name = pj_str("tynsel-modem");
+
+    pjmedia_port_info_init(&mp->base.info, &name, PJMEDIA_SIGNATURE('T','Y','N','M'),
+                           mcfg->clock_rate, mcfg->channel_count, 16,
+                           samples_per_frame);
+    mp->base.put_frame  = &modem_put_frame;
+    mp->base.get_frame  = &modem_get_frame;
+    mp->base.on_destroy = &modem_on_destroy;
+    mp->channels = mcfg->channel_count;
+
+    *p_port = mp;
+
+    return PJ_SUCCESS;
+}
+
+static int set_up_slots(void)
+{
+    server.slots = calloc(server.opts.max_calls, sizeof *server.slots);
+    if (!server.slots)
+        return 1;
+
+    for (unsigned i = 0; i < server.opts.max_calls; i++) {
+        struct call_slot *slot = &server.slots[i];
+        slot->index   = i;
+        slot->call    = PJSUA_INVALID_ID;
+        slot->conf_id = PJSUA_INVALID_ID;
+        slot->pool    = pjsua_pool_create("call", 4096, 4096);
+        if (!slot->pool)
+            return 1;
+        if (create_modem_port(slot->pool, &server.media_cfg, &slot->port) != PJ_SUCCESS)
+            return 1;
+        if (pjsua_conf_add_port(slot->pool, &slot->port->base, &slot->conf_id) != PJ_SUCCESS)
+            return 1;
+    }
+
+    return 0;
+}
+
+static struct call_slot *acquire_slot(pjsua_call_id call_id)
+{
+    struct call_slot *slot = NULL;
+
+    pthread_mutex_lock(&server.lock);
+    for (unsigned i = 0; i < server.opts.max_calls && !slot; i++) {
+        if (!server.slots[i].in_use) {
+            slot = &server.slots[i];
+            slot->in_use = 1;
+            slot->call   = call_id;
+        }
+    }
+    if (slot)
+        server.total_calls++;
+    else
+        server.rejected_calls++;
+    pthread_mutex_unlock(&server.lock);
+
+    return slot;
+}
+
+// Detaching waits for the media thread and destroying the modem for its
+// decoder thread, which may be blocked writing to stdout, so neither is done
+// under the server lock. Once its modem is taken out, nobody else reaches it,
+// and the slot is not given out again until it is gone.
+static void release_slot(struct call_slot *slot)
+{
+    pthread_mutex_lock(&server.lock);
+    struct modem *m = slot->modem;
+    slot->modem = NULL;
+    pthread_mutex_unlock(&server.lock);
+
+    if (m) {
+        port_detach(slot->port);
+        modem_destroy(m);
+    }
+
+    pthread_mutex_lock(&server.lock);
+    slot->call   = PJSUA_INVALID_ID;
+    slot->in_use = 0;
+    pthread_mutex_unlock(&server.lock);
+}
+
+static void tear_down_slots(void)
+{
+    for (unsigned i = 0; server.slots && i < server.opts.max_calls; i++) {
+        struct call_slot *slot = &server.slots[i];
+        if (slot->in_use)
+            release_slot(slot);
+        if (slot->conf_id != PJSUA_INVALID_ID)
+            pjsua_conf_remove_port(slot->conf_id);
+        if (slot->port)
+            pjmedia_port_destroy(&slot->port->base);
+        if (slot->pool)
+            pj_pool_release(slot->pool);
+    }
+    free(server.slots);
+    server.slots = NULL;
+}
+
 /* Callback called by the library upon receiving incoming call */
 static void on_incoming_call(pjsua_acc_id acc_id, pjsua_call_id call_id,
                              pjsip_rx_data *rdata)
@@ -43,10 +559,37 @@ static void on_incoming_call(pjsua_acc_id acc_id, pjsua_call_id call_id,
                          (int)ci.remote_info.slen,
                          ci.remote_info.ptr));
 
+    struct call_slot *slot = acquire_slot(call_id);
+    if (!slot) {
+        PJ_LOG(2,(THIS_FILE, "All %u modems busy, rejecting call %d",
+                             server.opts.max_calls, call_id));
+        pjsua_call_answer(call_id, 486, NULL, NULL);
+        return;
+    }
+
+    pjsua_call_set_user_data(call_id, slot);
+
     /* Automatically answer incoming calls with 200/OK */
     pjsua_call_answer(call_id, 200, NULL, NULL);
 }
 
+/* The slot a call was given, from its user data. An outgoing call is given
+ * its slot before it has an id, and its first callback can come before
+ * pjsua_call_make_call returns ; the id is filled in here, from whichever
+ * callback sees it first. */
+static struct call_slot *call_slot(pjsua_call_id call_id)
+{
+    struct call_slot *slot = pjsua_call_get_user_data(call_id);
+    if (slot) {
+        pthread_mutex_lock(&server.lock);
+        if (slot->call == PJSUA_INVALID_ID)
+            slot->call = call_id;
+        pthread_mutex_unlock(&server.lock);
+    }
+
+    return slot;
+}
+
 /* Callback called by the library when call's state has changed */
 static void on_call_state(pjsua_call_id call_id, pjsip_event *e)
 {
@@ -58,6 +601,14 @@ static void on_call_state(pjsua_call_id call_id, pjsip_event *e)
     PJ_LOG(3,(THIS_FILE, "Call %d state=%.*s", call_id,
                          (int)ci.state_text.slen,
                          ci.state_text.ptr));
+
+    if (ci.state == PJSIP_INV_STATE_DISCONNECTED) {
+        struct call_slot *slot = call_slot(call_id);
+        if (slot) {
+            pjsua_call_set_user_data(call_id, NULL);
+            release_slot(slot);
+        }
+    }
 }
 
 /* Callback called by the library when call's media state has changed */
@@ -66,74 +617,205 @@ static void on_call_media_state(pjsua_call_id call_id)
     pjsua_call_info ci;
 
     pjsua_call_get_info(call_id, &ci);
-    struct mydata *me = pjsua_acc_get_user_data(ci.acc_id);
+    struct call_slot *slot = call_slot(call_id);
+
+    if (ci.media_status != PJSUA_CALL_MEDIA_ACTIVE || !slot)
+        return;
+
+    pthread_mutex_lock(&server.lock);
+    if (!slot->modem) {
+        /* The caller transmits on the low channel and the answerer on the
+         * high one. */
+        int tx_channel = ci.role == PJSIP_ROLE_UAC ? 0 : 1;
+        slot->modem = modem_create(slot, server.media_cfg.clock_rate, tx_channel);
+        if (slot->modem)
+            port_attach(slot->port, slot->modem);
+    }
+    int ok = slot->modem != NULL;
+    pthread_mutex_unlock(&server.lock);
 
-    if (ci.media_status == PJSUA_CALL_MEDIA_ACTIVE) {
-        pjsua_conf_connect(me->play_port, ci.conf_slot);
-        pjsua_conf_connect(ci.conf_slot, me->rec_port);
+    if (!ok) {
+        PJ_LOG(1,(THIS_FILE, "Failed to set up modem for call %d", call_id));
+        pjsua_call_hangup(call_id, 500, NULL, NULL);
+        return;
     }
+
+    pjsua_conf_connect(slot->conf_id, ci.conf_slot);
+    pjsua_conf_connect(ci.conf_slot, slot->conf_id);
 }
 
 /* Display error and exit application */
 static void error_exit(const char *title, pj_status_t status)
 {
     pjsua_perror(THIS_FILE, title, status);
+    tear_down_slots();
     pjsua_destroy();
     exit(1);
 }
 
-static int set_up_wav_player(pjsua_conf_port_id *wav_port)
+static int write_stats(const char *filename, unsigned count, const struct call_report reports[count],
+                       unsigned long long total, unsigned long long rejected)
 {
-    pjsua_player_id wav_id;
-    unsigned play_options = PJMEDIA_FILE_NO_LOOP;
-    pj_str_t str = pj_str("data.wav");
-    pj_status_t status = pjsua_player_create(&str,
-            play_options, &wav_id);
-    if (status != PJ_SUCCESS)
-        return 1;
+    // written aside and renamed, so readers never see a partial file
+    char tmp[strlen(filename) + sizeof ".tmp"];
+    snprintf(tmp, sizeof tmp, "%s.tmp", filename);
+
+    FILE *f = fopen(tmp, "w");
+    if (!f)
+        return -1;
+
+    fprintf(f, "# tynsel sip stats 1 time %lld active %u total %llu rejected %llu\n",
+               (long long)time(NULL), count, total, rejected);
+    for (unsigned i = 0; i < count; i++)
+        metrics_print(f, &reports[i]);
+
+    if (fclose(f))
+        return -1;
+
+    return rename(tmp, filename);
+}
+
+static void *stats_writer(void *arg)
+{
+    struct call_report *reports = arg;
+
+    pthread_mutex_lock(&server.lock);
+    while (!server.stats_done) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += server.opts.stats_interval;
+        pthread_cond_timedwait(&server.stats_cond, &server.lock, &until);
+
+        unsigned count = 0;
+        for (unsigned i = 0; i < server.opts.max_calls; i++)
+            if (server.slots[i].modem)
+                metrics_snapshot(server.slots[i].modem, &reports[count++]);
+        unsigned long long total = server.total_calls;
+        unsigned long long rejected = server.rejected_calls;
+
+        pthread_mutex_unlock(&server.lock);
+        if (write_stats(server.opts.stats_file, count, reports, total, rejected))
+            PJ_LOG(2,(THIS_FILE, "Failed to write stats to %s", server.opts.stats_file));
+        pthread_mutex_lock(&server.lock);
+    }
+    pthread_mutex_unlock(&server.lock);
 
-    *wav_port = pjsua_player_get_conf_port(wav_id);
+    free(reports);
+
+    return NULL;
+}
+
+static int start_stats(void)
+{
+    struct call_report *reports = calloc(server.opts.max_calls, sizeof *reports);
+    if (!reports)
+        return -1;
+
+    if (pthread_create(&server.stats_thread, NULL, stats_writer, reports)) {
+        free(reports);
+        return -1;
+    }
 
     return 0;
 }
 
-static int set_up_wav_recorder(pjsua_conf_port_id *wav_port)
+static void stop_stats(void)
 {
-    pjsua_recorder_id wav_id;
-    unsigned record_options = 0;
-    pj_str_t str = pj_str("data-out.wav");
-    pj_status_t status = pjsua_recorder_create(&str,
-            0, NULL, -1, record_options, &wav_id);
-    if (status != PJ_SUCCESS)
-        return 1;
+    pthread_mutex_lock(&server.lock);
+    server.stats_done = 1;
+    pthread_cond_signal(&server.stats_cond);
+    pthread_mutex_unlock(&server.lock);
+
+    pthread_join(server.stats_thread, NULL);
+}
+
+static int parse_opts(struct server_opts *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "n:p:g:m:i:" "del")) != -1) {
+        switch (ch) {
+            case 'n': o->max_calls      = strtol(optarg, NULL, 0);  break;
+            case 'p': o->port           = strtol(optarg, NULL, 0);  break;
+            case 'g': o->greeting       = optarg;                   break;
+            case 'm': o->stats_file     = optarg;                   break;
+            case 'i': o->stats_interval = strtol(optarg, NULL, 0);  break;
+            case 'd': o->daemon         = 1;                        break;
+            case 'e': o->echo           = 1;                        break;
+            case 'l': o->local          = 1;                        break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    if (o->max_calls == 0) {
+        fprintf(stderr, "Need room for at least one call\n");
+        return -1;
+    }
 
-    *wav_port = pjsua_recorder_get_conf_port(wav_id);
+    if (o->stats_interval == 0) {
+        fprintf(stderr, "Stats interval must be at least a second\n");
+        return -1;
+    }
 
     return 0;
 }
 
+// queues text to every call in progress
+static void send_to_all(const char *text)
+{
+    size_t len = strlen(text);
+    pthread_mutex_lock(&server.lock);
+    for (unsigned i = 0; i < server.opts.max_calls; i++) {
+        struct modem *m = server.slots[i].modem;
+        if (!m)
+            continue;
+        size_t queued = encode_stream_queue(m->enc, len, (const unsigned char *)text);
+        if (queued < len)
+            printf("Call %u send queue full, dropped %zu bytes\n", i, len - queued);
+    }
+    pthread_mutex_unlock(&server.lock);
+}
+
 /*
  * main()
  *
- * argv[1] may contain URL to call.
+ * The first non-option argument may contain URL to call.
  */
 int main(int argc, char *argv[])
 {
     pjsua_acc_id acc_id;
+    pjsua_transport_id tp_id;
     pj_status_t status;
 
-    struct mydata me = { .play_port = 0 };
+    server.opts = (struct server_opts){
+        .max_calls      = DEFAULT_MAX_CALLS,
+        .port           = 5060,
+        .greeting       = NULL,
+        .echo           = 0,
+        .daemon         = 0,
+        .local          = 0,
+        .stats_file     = NULL,
+        .stats_interval = DEFAULT_STATS_INTERVAL,
+    };
+    if (parse_opts(&server.opts, argc, argv))
+        return 1;
+    const char *url = optind < argc ? argv[optind] : NULL;
+
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.stats_cond, NULL);
 
     /* Create pjsua first! */
     status = pjsua_create();
     if (status != PJ_SUCCESS) error_exit("Error in pjsua_create()", status);
 
     /* If argument is specified, it's got to be a valid SIP URL */
-    if (argc > 1) {
-        status = pjsua_verify_url(argv[1]);
+    if (url) {
+        status = pjsua_verify_url(url);
         if (status != PJ_SUCCESS) error_exit("Invalid URL in argv", status);
     }
 
+    pjsua_media_config_default(&server.media_cfg);
+
     /* Init pjsua */
     {
         pjsua_config cfg;
@@ -143,18 +825,21 @@ int main(int argc, char *argv[])
         cfg.cb.on_incoming_call = &on_incoming_call;
         cfg.cb.on_call_media_state = &on_call_media_state;
         cfg.cb.on_call_state = &on_call_state;
-
-        cfg.stun_host = pj_str(STUN_SERVER);
-        if (cfg.stun_srv_cnt==PJ_ARRAY_SIZE(cfg.stun_srv)) {
-            PJ_LOG(1,(THIS_FILE, "Error: too many STUN servers"));
-            return PJ_ETOOMANY;
+        cfg.max_calls = server.opts.max_calls;
+
+        if (!server.opts.local) {
+            cfg.stun_host = pj_str(STUN_SERVER);
+            if (cfg.stun_srv_cnt==PJ_ARRAY_SIZE(cfg.stun_srv)) {
+                PJ_LOG(1,(THIS_FILE, "Error: too many STUN servers"));
+                return PJ_ETOOMANY;
+            }
+            cfg.stun_srv[cfg.stun_srv_cnt++] = pj_str(STUN_SERVER);
         }
-        cfg.stun_srv[cfg.stun_srv_cnt++] = pj_str(STUN_SERVER);
 
         pjsua_logging_config_default(&log_cfg);
-        log_cfg.console_level = 4;
+        log_cfg.console_level = server.opts.daemon ? 3 : 4;
 
-        status = pjsua_init(&cfg, &log_cfg, NULL);
+        status = pjsua_init(&cfg, &log_cfg, &server.media_cfg);
         if (status != PJ_SUCCESS) error_exit("Error in pjsua_init()", status);
     }
 
@@ -163,8 +848,8 @@ int main(int argc, char *argv[])
         pjsua_transport_config cfg;
 
         pjsua_transport_config_default(&cfg);
-        cfg.port = 5060;
-        status = pjsua_transport_create(PJSIP_TRANSPORT_UDP, &cfg, NULL);
+        cfg.port = server.opts.port;
+        status = pjsua_transport_create(PJSIP_TRANSPORT_UDP, &cfg, &tp_id);
         if (status != PJ_SUCCESS) error_exit("Error creating transport", status);
     }
 
@@ -172,8 +857,17 @@ int main(int argc, char *argv[])
     status = pjsua_start();
     if (status != PJ_SUCCESS) error_exit("Error starting pjsua", status);
 
-    /* Register to SIP server by creating SIP account. */
-    {
+    /* The bridge only needs a clock, not a sound card */
+    status = pjsua_set_null_snd_dev();
+    if (status != PJ_SUCCESS) error_exit("Error setting null sound device", status);
+
+    if (server.opts.local) {
+        /* Take calls addressed straight to our transport, e.g. from another
+         * pjsua on the loopback interface. */
+        status = pjsua_acc_add_local(tp_id, PJ_TRUE, &acc_id);
+        if (status != PJ_SUCCESS) error_exit("Error adding local account", status);
+    } else {
+        /* Register to SIP server by creating SIP account. */
         pjsua_acc_config cfg;
 
         pjsua_acc_config_default(&cfg);
@@ -188,45 +882,67 @@ int main(int argc, char *argv[])
 
         status = pjsua_acc_add(&cfg, PJ_TRUE, &acc_id);
         if (status != PJ_SUCCESS) error_exit("Error adding account", status);
-        pjsua_acc_set_user_data(acc_id, &me);
     }
 
-    pjsua_conf_port_id play_port, rec_port;
-    int rc = 0;
-    rc = set_up_wav_player(&play_port);
-    rc = set_up_wav_recorder(&rec_port);
-    me.play_port = play_port;
-    me.rec_port = rec_port;
+    if (set_up_slots())
+        error_exit("Error setting up call slots", PJ_ENOMEM);
 
     /* If URL is specified, make call to the URL. */
-    if (argc > 1) {
-        pj_str_t uri = pj_str(argv[1]);
-        status = pjsua_call_make_call(acc_id, &uri, 0, NULL, NULL, NULL);
+    if (url) {
+        struct call_slot *slot = acquire_slot(PJSUA_INVALID_ID);
+        if (!slot)
+            error_exit("No modem free for the call", PJ_ETOOMANY);
+        pj_str_t uri = pj_str((char *)url);
+        status = pjsua_call_make_call(acc_id, &uri, 0, slot, NULL, NULL);
         if (status != PJ_SUCCESS) error_exit("Error making call", status);
     }
 
-    /* Wait until user press "q" to quit. */
-    for (;;) {
-        char option[10];
-
-        puts("Press 'h' to hangup all calls, 'q' to quit");
-        if (fgets(option, sizeof(option), stdin) == NULL) {
-            puts("EOF while reading stdin, will quit now..");
-            break;
+    if (server.opts.stats_file && start_stats())
+        error_exit("Error starting stats writer", PJ_ENOMEM);
+
+    if (server.opts.daemon) {
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        while (!quit)
+            pj_thread_sleep(200);
+    } else {
+        /* Wait until user press "q" to quit. */
+        for (;;) {
+            char option[256];
+
+            puts("Press 'h' to hangup all calls, 'q' to quit, 's <text>' to send text");
+            if (fgets(option, sizeof(option), stdin) == NULL) {
+                puts("EOF while reading stdin, will quit now..");
+                break;
+            }
+
+            if (option[0] == 'q')
+                break;
+
+            if (option[0] == 'h')
+                pjsua_call_hangup_all();
+
+            if (option[0] == 's' && option[1] == ' ') {
+                if (server.opts.echo)
+                    puts("Sending is not available with echo on");
+                else
+                    send_to_all(option + 2);
+            }
         }
-
-        if (option[0] == 'q')
-            break;
-
-        if (option[0] == 'h')
-            pjsua_call_hangup_all();
     }
 
+    pjsua_call_hangup_all();
+    if (server.opts.stats_file)
+        stop_stats();
+    tear_down_slots();
+
     /* Destroy pjsua */
     pjsua_destroy();
 
+    pthread_cond_destroy(&server.stats_cond);
+    pthread_mutex_destroy(&server.lock);
+
     return 0;
 }
 
 /* vi:set ts=4 sw=4 tw=80: */
-
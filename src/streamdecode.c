@@ -23,11 +23,62 @@
 #include "streamdecode.h"
 #include "audio.h"
 #include "filters.h"
+#include "trace.h"
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #define WINDOW_SIZE(as) ((int)(SAMPLES_PER_BIT(as) / 2))
+// A character is taken as complete, and the next START edge looked for, from
+// the middle of its last STOP bit : its START edge is only seen some way into
+// the bit, and waiting out the whole of the STOP bits from there would miss
+// the edge of a character sent straight after
+#define STOP_TICKS(as) (((as)->stop_bits - .5) * SAMPLES_PER_BIT(as))
+// Window energies are kept in fixed point, in units of 2^-ENERGY_BITS, so
+// that the running sums are exact : a window's energy is then a function of
+// the samples in it alone, however the stream was chunked or wherever the
+// decoder started, and never drifts. A term is at most ENERGY_MAX, which
+// keeps a window of up to 1024 (the filter length limit) within an int64_t.
+#define ENERGY_BITS 40
+#define ENERGY_MAX  ((double)(INT64_MAX >> 10) / (1ll << ENERGY_BITS))
+
+#define CHECKPOINT_MAGIC   "TYND"
+#define CHECKPOINT_VERSION 2
+
+// identifies the kind of decoder a checkpoint can be restored into ; the
+// state follows it
+struct checkpoint_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t channel;
+    uint32_t sample_rate;
+    uint32_t baud_rate;
+    uint8_t start_bits, data_bits, parity_bits, stop_bits;
+    uint32_t window;
+    uint32_t filter_len[3];
+    double freqs[2];        // of the channel's SPACE and MARK
+};
+
+#if STREAMDECODE_STATS
+#define STATS(...) __VA_ARGS__
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline unsigned long long stats_now(void) { return __rdtsc(); }
+#else
+#include <time.h>
+static inline unsigned long long stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+#else
+#define STATS(...)
+#endif
 
 struct stream_state {
     enum {
@@ -44,7 +95,7 @@ struct stream_state {
         STATE_ERROR,
 
         STATE_max,
-    } state;
+    } state, syncstate; // syncstate is the state to go back to on a false START
 
     unsigned tick; // samples since last state change
     unsigned gbltick; // samples since beginning of stream
@@ -53,16 +104,58 @@ struct stream_state {
     streamdecode_callback *cb;
     void *userdata;
 
+    int channel;
     struct filter_state *chan, *bit[2];
-    double *ehist[2];
-    double energy[2];
+    int64_t *ehist[2];  // the last WINDOW_SIZE energy terms, in fixed point
+    int64_t energy[2];  // their sum
+    unsigned wpos;      // slot in ehist of the oldest term
 
     int bitcount;
     unsigned charac;
     int parity; // counts the number of set bits in charac
     int levhist; // the last level seen, -1 if none seen
+
+    struct trace_state *trace; // not owned ; NULL when tracing is off
+
+    STATS(struct streamdecode_stats stats;)
+};
+
+struct filter_args {
+    enum filter_type type;
+    double cutoff;
 };
 
+// Chooses the filters for `channel' from its frequencies : one to pass that
+// channel and not the other, then a pair splitting it between its SPACE and
+// MARK tones, at their midpoint. The channel filter leaves a margin of the
+// baud rate beyond the channel's tones, or half the gap between the
+// channels if that is less ; for Bell 103 this comes to the cutoffs that
+// were once fixed. A channel without a partner only has what lies below
+// half its lower tone taken out, where the backward channels of such modems
+// sit.
+static void channel_filters(const struct audio_state *as, int channel, struct filter_args args[3])
+{
+    const double (*freqs)[2] = as->freqs ? as->freqs : bell103_freqs;
+    const double *mine = freqs[channel], *other = freqs[!channel];
+    const double lo = fmin(mine[0], mine[1]), hi = fmax(mine[0], mine[1]);
+    const double olo = fmin(other[0], other[1]), ohi = fmax(other[0], other[1]);
+
+    if (olo > hi) {
+        const double margin = fmin(as->baud_rate, (olo - hi) / 2);
+        args[0] = (struct filter_args){ FILTER_TYPE_LOW_PASS, hi + margin };
+    } else if (ohi < lo) {
+        const double margin = fmin(as->baud_rate, (lo - ohi) / 2);
+        args[0] = (struct filter_args){ FILTER_TYPE_HIGH_PASS, lo - margin };
+    } else {
+        args[0] = (struct filter_args){ FILTER_TYPE_HIGH_PASS, lo / 2 };
+    }
+
+    const double split = (lo + hi) / 2;
+    for (int b = 0; b < 2; b++)
+        args[1 + b] = (struct filter_args){
+            mine[b] < mine[!b] ? FILTER_TYPE_LOW_PASS : FILTER_TYPE_HIGH_PASS, split };
+}
+
 int streamdecode_init(struct stream_state **sp, struct audio_state *as, void *ud, streamdecode_callback *cb, int channel)
 {
     if (channel != 0 && channel != 1)
@@ -71,41 +164,47 @@ int streamdecode_init(struct stream_state **sp, struct audio_state *as, void *ud
     struct stream_state *s = *sp = malloc(sizeof *s);
 
     const int len = ((int)SAMPLES_PER_BIT(as)) | 1;
-    struct argset {
-        enum filter_type type;
-        double freq;
-        int len;
-        int rate;
-        double att;
-    } args[][3] = {
-        { { FILTER_TYPE_LOW_PASS , bell103_freqs[0][1] + 300, len, as->sample_rate, 21 },
-          { FILTER_TYPE_LOW_PASS , bell103_freqs[0][0] + 100, len, as->sample_rate, 21 },
-          { FILTER_TYPE_HIGH_PASS, bell103_freqs[0][0] + 100, len, as->sample_rate, 21 }, },
-
-        { { FILTER_TYPE_HIGH_PASS, bell103_freqs[1][0] - 300, len, as->sample_rate, 21 },
-          { FILTER_TYPE_LOW_PASS , bell103_freqs[1][0] + 100, len, as->sample_rate, 21 },
-          { FILTER_TYPE_HIGH_PASS, bell103_freqs[1][0] + 100, len, as->sample_rate, 21 }, },
-    };
+    struct filter_args args[3];
+    channel_filters(as, channel, args);
 
     s->cb       = cb;
     s->userdata = ud;
     s->state    = STATE_NOSYNC;
+    s->syncstate = STATE_NOSYNC;
     s->as       = *as;
-    // should stop hard-coding channel 0
-    const struct argset *arg = args[channel];
-    s->chan     = filter_create(arg[0].type, arg[0].freq, arg[0].len, arg[0].rate, arg[0].att);
-    s->bit[0]   = filter_create(arg[1].type, arg[1].freq, arg[1].len, arg[1].rate, arg[1].att);
-    s->bit[1]   = filter_create(arg[2].type, arg[2].freq, arg[2].len, arg[2].rate, arg[2].att);
-    // depends on IEEE-754-type zeros
+    s->channel  = channel;
+    s->chan     = filter_create(args[0].type, args[0].cutoff, len, as->sample_rate, 21);
+    s->bit[0]   = filter_create(args[1].type, args[1].cutoff, len, as->sample_rate, 21);
+    s->bit[1]   = filter_create(args[2].type, args[2].cutoff, len, as->sample_rate, 21);
+    filter_set_kernel(s->chan  , as->filter_kernel);
+    filter_set_kernel(s->bit[0], as->filter_kernel);
+    filter_set_kernel(s->bit[1], as->filter_kernel);
     s->ehist[0] = calloc(WINDOW_SIZE(&s->as), sizeof *s->ehist[0]);
     s->ehist[1] = calloc(WINDOW_SIZE(&s->as), sizeof *s->ehist[1]);
+    s->energy[0] = s->energy[1] = 0;
+    s->wpos     = 0;
     s->tick     = 0;
     s->levhist  = -1;
     s->gbltick  = 0;
+    s->trace    = NULL;
+    STATS(memset(&s->stats, 0, sizeof s->stats);)
 
     return 0;
 }
 
+static void emit(struct stream_state *s, int status)
+{
+    STATS(
+        unsigned long long t0 = stats_now();
+        s->stats.chars++;
+        s->stats.parity_errors += status == STREAM_ERR_PARITY;
+    )
+
+    s->cb(s->userdata, status, s->charac);
+
+    STATS(s->stats.cb_time += stats_now() - t0;)
+}
+
 static int state_update(struct stream_state *s)
 {
     double perbit = SAMPLES_PER_BIT(&s->as);
@@ -116,6 +215,15 @@ static int state_update(struct stream_state *s)
                    s->as.stop_bits;
     int have_edge = s->levhist == 1 && level == 0;
 
+    // Within a character the tick counts from its START edge, and each bit
+    // is placed from there alone, so that rounding to whole samples does not
+    // build up from one bit to the next
+    const double data_at   = s->as.start_bits * perbit;
+    const double parity_at = data_at + s->as.data_bits * perbit;
+    const double stop_at   = parity_at + s->as.parity_bits * perbit;
+    const double bitoffset = fmod(s->tick, perbit);
+    const int midbit = bitoffset >= perbit / 2 && bitoffset < (perbit / 2) + 1;
+
     switch (s->state) {
         case STATE_NOSYNC:
             // a START edge requires at least CHARBITS ticks of ONE followed by ZERO
@@ -123,13 +231,14 @@ static int state_update(struct stream_state *s)
         case STATE_BSYNC:
             // a START edge requires at least STOPBITS ticks of ONE followed by ZERO
             // TODO robustify edge detection ; discard spurious edges
-            if (s->tick < (s->as.stop_bits * perbit)) {
+            if (s->tick < STOP_TICKS(&s->as)) {
                 if (level == 0)
                     s->tick = 0; // reset tick counter so we count only strings of ONE
                 have_edge = 0;
             }
 
             if (have_edge) {
+                s->syncstate = s->state;
                 s->state    = STATE_START;
                 s->tick     = 0;
                 s->bitcount = 0;
@@ -138,55 +247,48 @@ static int state_update(struct stream_state *s)
             }
             break;
         case STATE_START:
-            // TODO robustify start-bit detection (drop spurious edges)
-            if (s->tick >= perbit) {
-                s->tick  = 0;
+            if (s->tick >= data_at) {
                 s->state = STATE_DATA;
+            } else if (s->tick >= perbit / 2 && s->tick < (perbit / 2) + 1 && level == 1) {
+                // the START bit did not hold until its middle ; treat the edge
+                // as spurious and go back to waiting for one
+                STATS(s->stats.false_starts++;)
+                s->state = s->syncstate;
+                s->tick  = 0;
             }
             break;
         case STATE_DATA:
-            if (s->tick >= s->as.data_bits * perbit) {
-                s->tick = 0;
+            if (s->tick >= parity_at) {
                 s->state = STATE_PARITY;
-            } else {
-                double bitoffset = fmod(s->tick, perbit);
+            } else if (midbit) {
                 // for now we just check the value at the middle of the bit
-                if (bitoffset >= (perbit / 2) && bitoffset < (perbit / 2) + 1) {
-                    // bits are received little-end first
-                    s->charac |= level << s->bitcount++;
-                    s->parity += level;
-                }
+                // bits are received little-end first
+                s->charac |= level << s->bitcount++;
+                s->parity += level;
             }
             break;
         case STATE_PARITY:
-            if (s->tick >= s->as.parity_bits * perbit) {
-                s->tick = 0;
+            if (s->tick >= stop_at) {
                 s->state = STATE_STOP;
-            } else {
-                double bitoffset = fmod(s->tick, perbit);
+            } else if (midbit) {
                 // for now we just check the value at the middle of the bit
-                if (bitoffset >= (perbit / 2) && bitoffset < (perbit / 2) + 1) {
-                    s->parity += level;
-                }
+                s->parity += level;
             }
             break;
         case STATE_STOP:
-            if (s->tick >= s->as.stop_bits * perbit) {
-                // we do not reset the tick counter, as the samples in the
-                // STOP bits are counted to determine when we get a valid
-                // START edge
+            if (s->tick >= stop_at + STOP_TICKS(&s->as)) {
+                // the samples in the STOP bits are counted on, to determine
+                // when we get a valid START edge
+                s->tick -= (unsigned)stop_at;
                 s->state = STATE_BSYNC;
                 if (s->as.parity_bits > 0 && s->parity & 1) {
                     // XXX allow parity to be adjustable instead of always EVEN
-                    s->cb(s->userdata, STREAM_ERR_PARITY, s->charac);
+                    emit(s, STREAM_ERR_PARITY);
                 } else {
-                    s->cb(s->userdata, 0, s->charac);
-                }
-            } else {
-                double bitoffset = fmod(s->tick, perbit);
-                if (bitoffset >= (perbit / 2) && bitoffset < (perbit / 2) + 1) {
-                    // TODO handle bad stop bits
+                    emit(s, STREAM_ERR_OK);
                 }
+            } else if (midbit) {
+                // TODO handle bad stop bits
             }
             break;
         default:
@@ -199,31 +301,61 @@ static int state_update(struct stream_state *s)
     return 0;
 }
 
-int streamdecode_process(struct stream_state *s, size_t count, double samples[count])
+int streamdecode_process(struct stream_state *s, size_t count, const double samples[count])
 {
     unsigned window_size = WINDOW_SIZE(&s->as);
+    STATS(s->stats.samples += count;)
     for (unsigned i = 0; i < count; i++) {
         s->gbltick++;
         s->tick++;
 
+        STATS(unsigned long long t0 = stats_now();)
         filter_put(s->chan, samples[i]);
         double bandpassed = filter_get(s->chan);
+        STATS(unsigned long long t1 = stats_now();)
+        // the window position lives in the state, so that it carries on
+        // from one call to the next
+        const unsigned slot = s->wpos;
+        s->wpos = slot + 1 == window_size ? 0 : slot + 1;
         for (int b = 0; b < 2; b++) {
             filter_put(s->bit[b], bandpassed);
-            double *energy = &s->energy[b];
-            double *trailing = &s->ehist[b][(i + window_size - 1) % window_size];
-            *energy -= *trailing;
-
             double bitval = filter_get(s->bit[b]);
             double term = bitval * bitval;
-            *trailing = term;
-            *energy += term;
+            if (term > ENERGY_MAX)
+                term = ENERGY_MAX;
+
+            int64_t fixed = llrint(term * (1ll << ENERGY_BITS));
+            s->energy[b] += fixed - s->ehist[b][slot];
+            s->ehist[b][slot] = fixed;
         }
+        STATS(
+            unsigned long long t2 = stats_now();
+            unsigned long long cb_before = s->stats.cb_time;
+        )
 
         // drop the first WINDOW_SIZE samples to make energy readings meaningful
         if (s->gbltick > window_size)
             if (state_update(s))
                 return -1;
+
+        STATS(
+            s->stats.chan_time  += t1 - t0;
+            s->stats.bit_time   += t2 - t1;
+            s->stats.state_time += stats_now() - t2 - (s->stats.cb_time - cb_before);
+        )
+
+        if (s->trace) {
+            struct trace_record rec = {
+                .tick       = s->gbltick,
+                .sample     = samples[i],
+                .bandpassed = bandpassed,
+                .energy     = { ldexp(s->energy[0], -ENERGY_BITS),
+                                ldexp(s->energy[1], -ENERGY_BITS) },
+                .level      = s->energy[1] > s->energy[0],
+                .state      = s->state,
+            };
+            trace_put(s->trace, &rec);
+        }
     }
 
     return 0;
@@ -241,3 +373,189 @@ void streamdecode_fini(struct stream_state *s)
     free(s);
 }
 
+void streamdecode_position(struct stream_state *s, struct streamdecode_position *p)
+{
+    memset(p, 0, sizeof *p);
+    p->levhist = s->levhist;
+
+    switch (s->state) {
+        case STATE_NOSYNC:
+        case STATE_BSYNC: {
+            // NOSYNC and BSYNC accept the same edges, and once the tick
+            // counter passes the STOP-bit threshold its exact value no longer
+            // matters ; everything else is reset by the next edge
+            unsigned threshold = ceil(STOP_TICKS(&s->as));
+            p->state = STATE_BSYNC;
+            p->tick  = s->tick < threshold ? s->tick : threshold;
+            break;
+        }
+        default:
+            p->state     = s->state;
+            p->syncstate = STATE_BSYNC;
+            p->tick      = s->tick;
+            p->bitcount  = s->bitcount;
+            p->charac    = s->charac;
+            p->parity    = s->parity;
+            break;
+    }
+}
+
+unsigned streamdecode_tick(struct stream_state *s)
+{
+    return s->gbltick;
+}
+
+static void checkpoint_header(struct stream_state *s, struct checkpoint_header *h)
+{
+    memset(h, 0, sizeof *h);
+    memcpy(h->magic, CHECKPOINT_MAGIC, sizeof h->magic);
+    h->version       = CHECKPOINT_VERSION;
+    h->channel       = s->channel;
+    h->sample_rate   = s->as.sample_rate;
+    h->baud_rate     = s->as.baud_rate;
+    h->start_bits    = s->as.start_bits;
+    h->data_bits     = s->as.data_bits;
+    h->parity_bits   = s->as.parity_bits;
+    h->stop_bits     = s->as.stop_bits;
+    h->window        = WINDOW_SIZE(&s->as);
+    h->filter_len[0] = filter_length(s->chan);
+    h->filter_len[1] = filter_length(s->bit[0]);
+    h->filter_len[2] = filter_length(s->bit[1]);
+    const double (*freqs)[2] = s->as.freqs ? s->as.freqs : bell103_freqs;
+    h->freqs[0]      = freqs[s->channel][0];
+    h->freqs[1]      = freqs[s->channel][1];
+}
+
+// the scalar part of the state, in the order it is stored
+#define CHECKPOINT_SCALARS(X) \
+    X(int32_t, state)         \
+    X(int32_t, syncstate)     \
+    X(uint32_t, tick)         \
+    X(uint32_t, gbltick)      \
+    X(int32_t, bitcount)      \
+    X(uint32_t, charac)       \
+    X(int32_t, parity)        \
+    X(int32_t, levhist)       \
+    X(int64_t, energy[0])     \
+    X(int64_t, energy[1])
+
+#define SCALAR_SIZE(type, field) + sizeof(type)
+
+size_t streamdecode_save_size(struct stream_state *s)
+{
+    struct checkpoint_header h;
+    checkpoint_header(s, &h);
+
+    return sizeof h CHECKPOINT_SCALARS(SCALAR_SIZE)
+         + 2 * h.window * sizeof *s->ehist[0]
+         + (h.filter_len[0] + h.filter_len[1] + h.filter_len[2]) * sizeof(double);
+}
+
+size_t streamdecode_save(struct stream_state *s, size_t len, void *buf)
+{
+    const size_t size = streamdecode_save_size(s);
+    if (len < size)
+        return 0;
+
+    unsigned char *p = buf;
+    struct checkpoint_header h;
+    checkpoint_header(s, &h);
+    memcpy(p, &h, sizeof h);
+    p += sizeof h;
+
+#define PUT_SCALAR(type, field) { type v = s->field; memcpy(p, &v, sizeof v); p += sizeof v; }
+    CHECKPOINT_SCALARS(PUT_SCALAR)
+#undef PUT_SCALAR
+
+    // windows and histories go oldest first, so that the layout does not
+    // depend on where in its ring the decoder happened to be
+    for (int b = 0; b < 2; b++) {
+        for (unsigned k = 0, slot = s->wpos; k < h.window; k++, slot = slot + 1 == h.window ? 0 : slot + 1) {
+            memcpy(p, &s->ehist[b][slot], sizeof s->ehist[b][slot]);
+            p += sizeof s->ehist[b][slot];
+        }
+    }
+
+    struct filter_state *filters[] = { s->chan, s->bit[0], s->bit[1] };
+    for (int f = 0; f < 3; f++) {
+        double history[h.filter_len[f]];
+        filter_save(filters[f], history);
+        memcpy(p, history, sizeof history);
+        p += sizeof history;
+    }
+
+    return size;
+}
+
+int streamdecode_restore(struct stream_state *s, size_t len, const void *buf)
+{
+    struct checkpoint_header mine, theirs;
+    checkpoint_header(s, &mine);
+    if (len != streamdecode_save_size(s))
+        goto invalid;
+    memcpy(&theirs, buf, sizeof theirs);
+    if (memcmp(&mine, &theirs, sizeof mine))
+        goto invalid;
+
+    const unsigned char *p = (const unsigned char *)buf + sizeof theirs;
+
+    {
+        struct stream_state t = *s;
+#define GET_SCALAR(type, field) { type v; memcpy(&v, p, sizeof v); t.field = v; p += sizeof v; }
+        CHECKPOINT_SCALARS(GET_SCALAR)
+#undef GET_SCALAR
+        if (t.state <= STATE_invalid || t.state >= STATE_max ||
+                t.syncstate <= STATE_invalid || t.syncstate >= STATE_max)
+            goto invalid;
+        *s = t;
+    }
+
+    for (int b = 0; b < 2; b++) {
+        memcpy(s->ehist[b], p, mine.window * sizeof *s->ehist[b]);
+        p += mine.window * sizeof *s->ehist[b];
+    }
+    s->wpos = 0;
+
+    struct filter_state *filters[] = { s->chan, s->bit[0], s->bit[1] };
+    for (int f = 0; f < 3; f++) {
+        double history[mine.filter_len[f]];
+        memcpy(history, p, sizeof history);
+        filter_restore(filters[f], history);
+        p += sizeof history;
+    }
+
+    return 0;
+invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+void streamdecode_trace(struct stream_state *s, struct trace_state *t)
+{
+    s->trace = t;
+}
+
+int streamdecode_stats(struct stream_state *s, struct streamdecode_stats *st)
+{
+#if STREAMDECODE_STATS
+    *st = s->stats;
+    return 0;
+#else
+    (void)s;
+    memset(st, 0, sizeof *st);
+    return -1;
+#endif
+}
+
+void streamdecode_stats_add(struct streamdecode_stats *acc, const struct streamdecode_stats *in)
+{
+    acc->samples       += in->samples;
+    acc->chan_time     += in->chan_time;
+    acc->bit_time      += in->bit_time;
+    acc->state_time    += in->state_time;
+    acc->cb_time       += in->cb_time;
+    acc->chars         += in->chars;
+    acc->parity_errors += in->parity_errors;
+    acc->false_starts  += in->false_starts;
+}
+
@@ -1,6 +1,8 @@
 #ifndef STREAMDECODE_H_
 #define STREAMDECODE_H_
 
+#include "tynsel_api.h"
+
 #include <stddef.h>
 
 // consider supplying temporal context to the decoded character
@@ -10,6 +12,7 @@ typedef int streamdecode_callback(void *userdata, int status, int data);
 
 struct stream_state;
 struct audio_state;
+struct trace_state;
 
 enum {
     STREAM_ERR_OK = 0,
@@ -19,9 +22,63 @@ enum {
     STREAM_ERR_max
 };
 
-int streamdecode_init(struct stream_state **sp, struct audio_state *as, void *ud, streamdecode_callback *cb, int channel);
-int streamdecode_process(struct stream_state *s, size_t count, double samples[count]);
-void streamdecode_fini(struct stream_state *s);
+// hot-path counters, only gathered when built with STREAMDECODE_STATS
+// times are in cycles where a cycle counter is available, else nanoseconds
+struct streamdecode_stats {
+    unsigned long long samples;       // samples passed to streamdecode_process
+    unsigned long long chan_time;     // spent in the channel filter
+    unsigned long long bit_time;      // spent in the bit filters and energy windows
+    unsigned long long state_time;    // spent in the state machine, excluding callbacks
+    unsigned long long cb_time;       // spent in the callback
+    unsigned long long chars;         // characters emitted, including parity failures
+    unsigned long long parity_errors;
+    unsigned long long false_starts;  // START edges abandoned in favour of resynching
+};
+
+TYNSEL_API int streamdecode_init(struct stream_state **sp, struct audio_state *as, void *ud, streamdecode_callback *cb, int channel);
+TYNSEL_API int streamdecode_process(struct stream_state *s, size_t count, const double samples[count]);
+TYNSEL_API void streamdecode_fini(struct stream_state *s);
+
+// The decoder's place in the character framing : the part of its state that
+// is not simply a function of the last few bit times of input. Two decoders
+// fed the same input, long enough for their filters to settle, behave
+// identically from the point where their positions compare equal with memcmp.
+struct streamdecode_position {
+    int state, syncstate;
+    unsigned tick;
+    int levhist;
+    int bitcount;
+    unsigned charac;
+    int parity;
+};
+
+TYNSEL_API void streamdecode_position(struct stream_state *s, struct streamdecode_position *p);
+
+// samples processed since init, modulo 2^32 ; from inside the callback, this
+// counts up to and including the sample that completed the character
+TYNSEL_API unsigned streamdecode_tick(struct stream_state *s);
+
+// A checkpoint is a decoder's whole state as a compact versioned buffer, in
+// host byte order. A decoder restored from it carries on exactly where the
+// saved one left off, mid-character included, as if it had seen all the same
+// input. The restored decoder must come from streamdecode_init with the same
+// audio settings and channel, and can be in another thread or process.
+// Statistics and tracing are not part of the state.
+TYNSEL_API size_t streamdecode_save_size(struct stream_state *s);
+// returns the number of bytes written, or 0 if `len' is too small
+TYNSEL_API size_t streamdecode_save(struct stream_state *s, size_t len, void *buf);
+// returns -1 with errno EINVAL, leaving `s' as it was, if `buf' is not a
+// checkpoint of a decoder like `s'
+TYNSEL_API int streamdecode_restore(struct stream_state *s, size_t len, const void *buf);
+
+// records per-sample decoder internals to `t' (see trace.h) until called
+// again with NULL ; the caller keeps ownership of `t'
+TYNSEL_API void streamdecode_trace(struct stream_state *s, struct trace_state *t);
+
+// returns -1 (and zeroes *st) if stats were not compiled in
+TYNSEL_API int streamdecode_stats(struct stream_state *s, struct streamdecode_stats *st);
+// accumulates `in' into `acc', for aggregating over a pool of streams
+TYNSEL_API void streamdecode_stats_add(struct streamdecode_stats *acc, const struct streamdecode_stats *in);
 
 #endif
 
@@ -5,38 +5,222 @@
 #include <time.h>
 #include <sndfile.h>
 #include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
 
 #include "audio.h"
 #include "filters.h"
 #include "streamdecode.h"
+#include "filedecode.h"
+#include "burst.h"
+#include "trace.h"
+#include "io.h"
+#include "output.h"
+#include "autotune.h"
 
+// bytes of output gathered before writing
+#define OUTPUT_BUFFER (1 << 18)
+
+struct suite_opts {
+    const char *trace_file;
+    unsigned threads;
+    int use_index;
+    int all_channels;
+    // headerless input, when raw_rate is nonzero
+    unsigned raw_rate;
+    enum pcm_format raw_format;
+    int raw_channels;
+    size_t feed;            // frames per call to the decoder, 0 for the default
+    int timestamps;
+    enum output_format output;
+    enum filter_kernel kernel;
+    int kernel_set;         // given with -K, even as `default'
+    const char *tune_cache;  // autotune, keeping the answer here
+    enum fsk_profile profile;
+    // checkpoints : rebuild the decoder from one every so many frames, save
+    // one at the end, or carry on from one
+    size_t rebuild;
+    const char *save_file;
+    const char *load_file;
+};
+
+// where emit sends characters, and what it needs to know to give their offsets
+struct emit_state {
+    struct output *out;
+    struct stream_state *sd;    // the sequential decoder
+    struct filedecode_ticks ticks;
+};
+
+static int parse_opts(struct suite_opts *o, int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "T:j:r:f:c:B:O:K:A:p:R:S:L:" "axt")) != -1) {
+        switch (ch) {
+            case 'T': o->trace_file = optarg;                   break;
+            case 'j': o->threads    = strtol(optarg, NULL, 0);  break;
+            case 'a': o->all_channels = 1;                      break;
+            case 'r': o->raw_rate   = strtol(optarg, NULL, 0);  break;
+            case 'c': o->raw_channels = strtol(optarg, NULL, 0); break;
+            case 'B': o->feed       = strtoul(optarg, NULL, 0); break;
+            case 't': o->timestamps = 1;                        break;
+            case 'f':
+                if (pcm_format_parse(optarg, &o->raw_format)) {
+                    fprintf(stderr, "Unknown sample format `%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'x': o->use_index  = 1;                        break;
+            case 'A': o->tune_cache = optarg;                   break;
+            case 'R': o->rebuild    = strtoul(optarg, NULL, 0); break;
+            case 'S': o->save_file  = optarg;                   break;
+            case 'L': o->load_file  = optarg;                   break;
+            case 'K':
+                if (filter_kernel_parse(optarg, &o->kernel)) {
+                    fprintf(stderr, "Unknown filter kernel `%s'\n", optarg);
+                    return -1;
+                }
+                o->kernel_set = 1;
+                break;
+            case 'O':
+                if (output_format_parse(optarg, &o->output)) {
+                    fprintf(stderr, "Unknown output format `%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'p':
+                if (fsk_profile_parse(optarg, &o->profile)) {
+                    fprintf(stderr, "Unknown modem profile `%s'\n", optarg);
+                    return -1;
+                }
+                break;
+
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int emit_tagged(void *userdata, int fchan, uint64_t offset, int status, int data)
+{
+    struct emit_state *e = userdata;
+    return output_char(e->out, fchan, offset, status, data);
+}
+
+// for the sequential decoder, which started at the start of the input
 static int emit(void *userdata, int status, int data)
 {
-    (void)userdata;
-    switch (status) {
-        case STREAM_ERR_OK:
-            printf("char '%c' (%d)\n", data, data);
-            break;
-        case STREAM_ERR_PARITY:
-            printf("char '%c' (%d) (PARITY FAILED)\n", data, data);
-            break;
-        default:
-            printf("unknown error\n");
-            break;
+    struct emit_state *e = userdata;
+    return emit_tagged(userdata, 0, filedecode_offset(&e->ticks, e->sd, 0), status, data);
+}
+
+// flushes what is left of the output, reporting failure
+static int close_output(struct output *out)
+{
+    if (output_close(out)) {
+        fprintf(stderr, "Failed to write output : %s\n", strerror(errno));
+        return -1;
     }
 
     return 0;
 }
 
+static int save_checkpoint(struct stream_state *sd, const char *filename)
+{
+    size_t len = streamdecode_save_size(sd);
+    void *buf = malloc(len);
+    if (!buf)
+        return -1;
+
+    FILE *f = NULL;
+    int rc = streamdecode_save(sd, len, buf) && (f = fopen(filename, "wb"))
+          && fwrite(buf, len, 1, f) == 1 ? 0 : -1;
+    if (f && fclose(f))
+        rc = -1;
+    free(buf);
+
+    return rc;
+}
+
+// a file of the wrong size is passed on as it is, for restore to refuse
+static int load_checkpoint(struct stream_state *sd, const char *filename)
+{
+    size_t len = streamdecode_save_size(sd) + 1;
+    void *buf = malloc(len);
+    FILE *f = fopen(filename, "rb");
+    int rc = -1;
+    if (buf && f) {
+        len = fread(buf, 1, len, f);
+        rc = ferror(f) ? -1 : streamdecode_restore(sd, len, buf);
+    }
+    if (f)
+        fclose(f);
+    free(buf);
+
+    return rc;
+}
+
+static void print_stats(const struct streamdecode_stats *st)
+{
+    fprintf(stderr, "samples %llu chan %llu bit %llu state %llu cb %llu "
+                    "chars %llu parity %llu false-starts %llu\n",
+            st->samples, st->chan_time, st->bit_time, st->state_time, st->cb_time,
+            st->chars, st->parity_errors, st->false_starts);
+}
+
+// decodes only the carrier bursts listed in `filename'.bursts, scanning the
+// file and writing the index first if there is no usable one
+static int decode_indexed(const char *filename, SNDFILE *sf, SF_INFO *sinfo,
+        struct audio_state *as, int channel, struct emit_state *es, struct streamdecode_stats *st)
+{
+    char index_file[strlen(filename) + sizeof ".bursts"];
+    snprintf(index_file, sizeof index_file, "%s.bursts", filename);
+
+    struct burst_list list = { .count = 0 };
+    if (burst_index_read(index_file, as, sinfo->frames, &list.count, &list.bursts)) {
+        size_t frames;
+        if (burst_scan_file(filename, as, &frames, &list, burst_collect))
+            return -1;
+        if (burst_index_write(index_file, as, frames, list.count, list.bursts))
+            fprintf(stderr, "Warning, failed to write `%s' : %s\n", index_file, strerror(errno));
+    }
+
+    int rc = filedecode_bursts(sf, sinfo->channels, as, channel, list.count, list.bursts, es, emit_tagged, st);
+    free(list.bursts);
+
+    return rc;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 3) {
-        fprintf(stderr, "Supply channel number and input filename\n");
+    struct suite_opts opts = {
+        .trace_file   = NULL,
+        .threads      = 1,
+        .use_index    = 0,
+        .all_channels = 0,
+        .raw_rate     = 0,
+        .raw_format   = PCM_S16,
+        .raw_channels = 1,
+        .feed         = 0,
+        .timestamps   = 0,
+        .output       = OUTPUT_TEXT,
+        .kernel       = FILTER_KERNEL_DEFAULT,
+        .tune_cache   = NULL,
+        .profile      = FSK_PROFILE_BELL103,
+        .rebuild      = 0,
+        .save_file    = NULL,
+        .load_file    = NULL,
+    };
+    if (parse_opts(&opts, argc, argv))
+        return EXIT_FAILURE;
+
+    if (argc - optind != 2) {
+        fprintf(stderr, "Supply channel number and input filename (`-' for stdin)\n");
         return EXIT_FAILURE;
     }
 
-    int channel = strtol(argv[1], NULL, 0);
-    const char *filename = argv[2];
+    int channel = strtol(argv[optind], NULL, 0);
+    const char *filename = argv[optind + 1];
 
     struct audio_state _as = {
         .baud_rate   = 300,
@@ -44,12 +228,22 @@ int main(int argc, char *argv[])
         .data_bits   = 7,
         .stop_bits   = 2,
         .parity_bits = 1,
+        .freqs       = bell103_freqs,
     }, *as = &_as;
 
+    const int from_stdin = !strcmp(filename, "-");
     SNDFILE *sf = NULL;
     SF_INFO sinfo = { .format = 0 };
     {
-        sf = sf_open(filename, SFM_READ, &sinfo);
+        if (opts.raw_rate) {
+            sinfo.samplerate = opts.raw_rate;
+            sinfo.channels   = opts.raw_channels;
+            sinfo.format     = SF_FORMAT_RAW | pcm_format_sf(opts.raw_format);
+        }
+        if (from_stdin)
+            sf = sf_open_fd(STDIN_FILENO, SFM_READ, &sinfo, 0);
+        else
+            sf = sf_open(filename, SFM_READ, &sinfo);
         if (!sf) {
             fprintf(stderr, "Failed to open `%s' for reading : %s\n", filename, strerror(errno));
             exit(EXIT_FAILURE);
@@ -62,31 +256,164 @@ int main(int argc, char *argv[])
         as->sample_rate = sinfo.samplerate;
     }
 
+    audio_set_profile(as, opts.profile);
+    as->filter_kernel = opts.kernel;
+    size_t tuned_feed = 0;
+    if (opts.tune_cache) {
+        struct autotune_choice c;
+        int rc = autotune(opts.tune_cache, as, channel, &c, 1);
+        if (rc < 0) {
+            fprintf(stderr, "Failed to autotune : %s\n", strerror(errno));
+        } else {
+            fprintf(stderr, "autotune: kernel %s feed %zu%s\n", filter_kernel_name(c.kernel),
+                    c.feed, rc ? " (cached)" : "");
+            // explicit choices on the command line win
+            if (!opts.kernel_set)
+                as->filter_kernel = c.kernel;
+            tuned_feed = c.feed;
+        }
+    }
+
+    // the chunked and indexed modes open the file again by name, which does
+    // not work for streams, nor for headerless files
+    const int reopenable = sinfo.seekable && !opts.raw_rate;
+
+    const int sequential = !opts.all_channels && !(opts.use_index && reopenable)
+                        && !(opts.threads > 1 && reopenable);
+    if (!sequential && opts.feed)
+        fprintf(stderr, "Warning, `-B' needs sequential decoding, ignoring it\n");
+    // the tuned feed only matters where -B would
+    if (sequential && !opts.feed)
+        opts.feed = tuned_feed;
+    if (!sequential && (opts.rebuild || opts.save_file || opts.load_file))
+        fprintf(stderr, "Warning, checkpoints need sequential decoding, ignoring `-R', `-S' and `-L'\n");
+
+    // characters from a stream go out as they come, to keep latency down
+    struct emit_state es = { .sd = NULL };
+    if (output_open(&es.out, STDOUT_FILENO, opts.output, OUTPUT_BUFFER, !sinfo.seekable,
+                    channel, opts.all_channels, opts.timestamps)) {
+        fprintf(stderr, "Failed to set up output : %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.all_channels) {
+        if (opts.trace_file || opts.use_index)
+            fprintf(stderr, "Warning, `-T' and `-x' are not supported with -a, ignoring them\n");
+
+        struct streamdecode_stats st = { .samples = 0 };
+        int rc = filedecode_channels(sf, sinfo.channels, as, channel, opts.threads, &es, emit_tagged, &st);
+        if (rc)
+            fprintf(stderr, "Failed to decode `%s' : %s\n", filename, strerror(errno));
+        else if (st.samples)
+            print_stats(&st);
+        sf_close(sf);
+
+        return close_output(es.out) || rc ? EXIT_FAILURE : 0;
+    }
+
+    if (opts.use_index && reopenable) {
+        if (opts.trace_file)
+            fprintf(stderr, "Warning, tracing is not supported with -x, ignoring `-T'\n");
+
+        struct streamdecode_stats st = { .samples = 0 };
+        int rc = decode_indexed(filename, sf, &sinfo, as, channel, &es, &st);
+        if (rc)
+            fprintf(stderr, "Failed to decode `%s' : %s\n", filename, strerror(errno));
+        else if (st.samples)
+            print_stats(&st);
+        sf_close(sf);
+
+        return close_output(es.out) || rc ? EXIT_FAILURE : 0;
+    }
+
+    if (opts.threads > 1 && reopenable) {
+        sf_close(sf);
+        if (opts.trace_file)
+            fprintf(stderr, "Warning, tracing is not supported with -j, ignoring `-T'\n");
+
+        struct streamdecode_stats st = { .samples = 0 };
+        if (filedecode_parallel(filename, as, channel, opts.threads, &es, emit_tagged, &st)) {
+            fprintf(stderr, "Failed to decode `%s' : %s\n", filename, strerror(errno));
+            close_output(es.out);
+            return EXIT_FAILURE;
+        }
+        if (st.samples)
+            print_stats(&st);
+
+        return close_output(es.out) ? EXIT_FAILURE : 0;
+    }
+
     struct stream_state *sd;
-    streamdecode_init(&sd, as, NULL, emit, channel);
-
-    sf_count_t count = 0;
-    if (sinfo.channels == 1) {
-        do {
-            double tmp[1024];
-            count = sf_read_double(sf, tmp, 1024);
-            streamdecode_process(sd, count, tmp);
-        } while (count);
+    streamdecode_init(&sd, as, &es, emit, channel);
+    es.sd = sd;
+
+    if (opts.load_file && load_checkpoint(sd, opts.load_file)) {
+        fprintf(stderr, "Failed to restore `%s' : %s\n", opts.load_file, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // the trace belongs to the first decoder, which -R replaces
+    if (opts.trace_file && opts.rebuild) {
+        fprintf(stderr, "Warning, tracing is not supported with -R, ignoring `-T'\n");
+        opts.trace_file = NULL;
+    }
+
+    struct trace_state *trace = NULL;
+    if (opts.trace_file) {
+        if (trace_open(&trace, opts.trace_file, as->sample_rate, channel)) {
+            fprintf(stderr, "Failed to open trace `%s' : %s\n", opts.trace_file, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        streamdecode_trace(sd, trace);
+    }
+
+    // uncompressed files are decoded straight out of memory ; anything else
+    // goes through libsndfile
+    struct pcm_view view;
+    int mapped = !opts.rebuild && !from_stdin && !(opts.raw_rate
+            ? pcm_map_raw(&view, filename, opts.raw_rate, opts.raw_channels, opts.raw_format)
+            : pcm_map(&view, filename));
+    int rc;
+    if (opts.rebuild) {
+        rc = filedecode_rebuilt(sf, sinfo.channels, as, channel, &es, emit, &es.sd,
+                                opts.feed, opts.rebuild);
+        sd = es.sd;
+    } else if (mapped) {
+        rc = filedecode_mapped(&view, 0, sd, opts.feed);
+        pcm_unmap(&view);
     } else {
-        do {
-            double tmp[sinfo.channels];
-            count = sf_read_double(sf, tmp, sinfo.channels);
-            streamdecode_process(sd, 1, tmp);
-        } while (count);
+        // a stream is read one block at a time, to keep latency down
+        rc = filedecode_stream(sf, sinfo.channels, sd, sinfo.seekable ? FILEDECODE_READAHEAD : 1, opts.feed);
     }
+    if (rc)
+        fprintf(stderr, "Failed to decode `%s' : %s\n", filename, strerror(errno));
+
+    if (!rc && opts.save_file && save_checkpoint(sd, opts.save_file)) {
+        fprintf(stderr, "Failed to write checkpoint `%s' : %s\n", opts.save_file, strerror(errno));
+        rc = -1;
+    }
+
+    struct streamdecode_stats st;
+    if (!streamdecode_stats(sd, &st))
+        print_stats(&st);
 
     streamdecode_fini(sd);
 
+    if (trace) {
+        unsigned long dropped = trace_dropped(trace);
+        if (dropped)
+            fprintf(stderr, "Warning, dropped %lu trace records\n", dropped);
+        if (trace_close(trace)) {
+            fprintf(stderr, "Failed to write trace `%s' : %s\n", opts.trace_file, strerror(errno));
+            rc = -1;
+        }
+    }
+
     if (sf_error(sf))
         sf_perror(sf);
 
     sf_close(sf);
 
-    return 0;
+    return close_output(es.out) || rc ? EXIT_FAILURE : 0;
 }
 
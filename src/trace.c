@@ -0,0 +1,127 @@
+#define _XOPEN_SOURCE 600
+
+#include "trace.h"
+#include "ring.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// about 1.5 seconds of samples at 44.1kHz
+#define TRACE_RING_RECORDS 65536
+#define TRACE_WRITE_BATCH  1024
+
+struct trace_state {
+    FILE *f;
+    struct ring *ring;
+    pthread_t writer;
+    int done;
+    unsigned long dropped;
+    unsigned long unwritten;    // records lost to failed writes ; writer only
+    int write_errno;            // why the first of those failed
+};
+
+static void *trace_writer(void *arg)
+{
+    struct trace_state *t = arg;
+    struct trace_record batch[TRACE_WRITE_BATCH];
+
+    for (;;) {
+        // read `done' before draining so records put before trace_close are
+        // always written
+        int done = __atomic_load_n(&t->done, __ATOMIC_ACQUIRE);
+        size_t n = 0;
+        while (n < TRACE_WRITE_BATCH && !ring_get(t->ring, &batch[n]))
+            n++;
+
+        if (n) {
+            errno = 0;
+            size_t written = fwrite(batch, sizeof batch[0], n, t->f);
+            if (written < n) {
+                if (!t->unwritten)
+                    t->write_errno = errno ? errno : EIO;
+                t->unwritten += n - written;
+            }
+        } else if (done)
+            break;
+        else
+            nanosleep(&(struct timespec){ .tv_nsec = 10 * 1000 * 1000 }, NULL);
+    }
+
+    return NULL;
+}
+
+int trace_open(struct trace_state **tp, const char *filename, unsigned sample_rate, unsigned channel)
+{
+    struct trace_state *t = *tp = malloc(sizeof *t);
+    if (!t)
+        return -1;
+
+    t->done    = 0;
+    t->dropped = 0;
+    t->unwritten   = 0;
+    t->write_errno = 0;
+    t->ring    = ring_create(sizeof(struct trace_record), TRACE_RING_RECORDS);
+    t->f       = fopen(filename, "wb");
+    if (!t->ring || !t->f)
+        goto error;
+
+    struct trace_header h = {
+        .magic       = TRACE_MAGIC,
+        .version     = TRACE_VERSION,
+        .record_size = sizeof(struct trace_record),
+        .sample_rate = sample_rate,
+        .channel     = channel,
+    };
+    if (fwrite(&h, sizeof h, 1, t->f) != 1)
+        goto error;
+
+    if (pthread_create(&t->writer, NULL, trace_writer, t))
+        goto error;
+
+    return 0;
+error:
+    if (t->f)
+        fclose(t->f);
+    if (t->ring)
+        ring_destroy(t->ring);
+    free(t);
+    *tp = NULL;
+    return -1;
+}
+
+int trace_put(struct trace_state *t, const struct trace_record *rec)
+{
+    if (ring_put(t->ring, rec)) {
+        __atomic_add_fetch(&t->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    return 0;
+}
+
+unsigned long trace_dropped(struct trace_state *t)
+{
+    return __atomic_load_n(&t->dropped, __ATOMIC_RELAXED);
+}
+
+int trace_close(struct trace_state *t)
+{
+    __atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+    pthread_join(t->writer, NULL);
+
+    int rc = fclose(t->f) ? -1 : 0;
+    if (t->unwritten) {
+        // the file is cut short ; the first failure says more than the close
+        errno = t->write_errno;
+        rc = -1;
+    }
+    ring_destroy(t->ring);
+    free(t);
+
+    return rc;
+}
+
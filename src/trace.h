@@ -0,0 +1,46 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "tynsel_api.h"
+
+#include <stdint.h>
+
+// A trace file is a trace_header followed by trace_records, all in host byte
+// order. Records are queued by the decoding thread without blocking and
+// written out by a background thread ; if the writer falls behind, records
+// are dropped and counted rather than stalling the decoder.
+
+#define TRACE_MAGIC   "TYNT"
+#define TRACE_VERSION 1
+
+struct trace_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t sample_rate;
+    uint32_t channel;
+};
+
+struct trace_record {
+    uint32_t tick;      // sample index since the start of the stream
+    float sample;       // input sample
+    float bandpassed;   // output of the channel filter
+    float energy[2];    // windowed energy of the SPACE and MARK filters
+    uint8_t level;      // level decision (energy[1] > energy[0])
+    uint8_t state;      // decoder state after this sample
+    uint8_t pad[2];
+};
+
+struct trace_state;
+
+TYNSEL_API int trace_open(struct trace_state **tp, const char *filename, unsigned sample_rate, unsigned channel);
+// returns -1 if the record had to be dropped
+TYNSEL_API int trace_put(struct trace_state *t, const struct trace_record *rec);
+TYNSEL_API unsigned long trace_dropped(struct trace_state *t);
+// flushes outstanding records, stops the writer and closes the file ;
+// returns -1 with errno set if any records failed to be written, or the
+// file failed to close
+TYNSEL_API int trace_close(struct trace_state *t);
+
+#endif
+
@@ -0,0 +1,108 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include <sndfile.h>
+
+#define BATCH 4096
+
+// channels in the output WAV, in order
+enum { WAV_SAMPLE, WAV_BANDPASSED, WAV_ENERGY0, WAV_ENERGY1, WAV_LEVEL, WAV_STATE, WAV_max };
+
+int main(int argc, char *argv[])
+{
+    const char *wav_file = NULL;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "w:")) != -1) {
+        switch (ch) {
+            case 'w': wav_file = optarg; break;
+            default: fprintf(stderr, "args error before argument index %d\n", optind); return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-w out.wav] trace-file\n"
+                        "Converts a decoder trace to CSV on stdout, or to a WAV file\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *filename = argv[optind];
+    FILE *in = fopen(filename, "rb");
+    if (!in) {
+        fprintf(stderr, "Failed to open `%s' for reading : %s\n", filename, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct trace_header h;
+    if (fread(&h, sizeof h, 1, in) != 1 || memcmp(h.magic, TRACE_MAGIC, sizeof h.magic)) {
+        fprintf(stderr, "`%s' is not a trace file\n", filename);
+        return EXIT_FAILURE;
+    }
+    if (h.version != TRACE_VERSION || h.record_size != sizeof(struct trace_record)) {
+        fprintf(stderr, "`%s' has unsupported version %d\n", filename, h.version);
+        return EXIT_FAILURE;
+    }
+
+    SNDFILE *sf = NULL;
+    if (wav_file) {
+        SF_INFO sinfo = {
+            .samplerate = h.sample_rate,
+            .channels   = WAV_max,
+            .format     = SF_FORMAT_WAV | SF_FORMAT_FLOAT,
+        };
+        sf = sf_open(wav_file, SFM_WRITE, &sinfo);
+        if (!sf) {
+            fprintf(stderr, "Failed to open `%s' : %s\n", wav_file, sf_strerror(sf));
+            return EXIT_FAILURE;
+        }
+    } else {
+        printf("tick,sample,bandpassed,energy0,energy1,level,state\n");
+    }
+
+    int failed = 0;
+    size_t count;
+    do {
+        struct trace_record recs[BATCH];
+        count = fread(recs, sizeof recs[0], BATCH, in);
+        if (sf) {
+            static double frames[BATCH][WAV_max];
+            for (size_t i = 0; i < count; i++) {
+                frames[i][WAV_SAMPLE    ] = recs[i].sample;
+                frames[i][WAV_BANDPASSED] = recs[i].bandpassed;
+                frames[i][WAV_ENERGY0   ] = recs[i].energy[0];
+                frames[i][WAV_ENERGY1   ] = recs[i].energy[1];
+                frames[i][WAV_LEVEL     ] = recs[i].level;
+                frames[i][WAV_STATE     ] = recs[i].state;
+            }
+            if (sf_writef_double(sf, &frames[0][0], count) != (sf_count_t)count)
+                failed = 1;
+        } else {
+            for (size_t i = 0; i < count; i++)
+                printf("%u,%g,%g,%g,%g,%d,%d\n", recs[i].tick, recs[i].sample,
+                        recs[i].bandpassed, recs[i].energy[0], recs[i].energy[1],
+                        recs[i].level, recs[i].state);
+        }
+    } while (count == BATCH);
+
+    if (sf) {
+        if (failed || sf_error(sf)) {
+            fprintf(stderr, "Failed to write `%s' : %s\n", wav_file, sf_strerror(sf));
+            failed = 1;
+        }
+        if (sf_close(sf))
+            failed = 1;
+    } else if (fflush(stdout) || ferror(stdout)) {
+        fprintf(stderr, "Failed to write CSV : %s\n", strerror(errno));
+        failed = 1;
+    }
+
+    fclose(in);
+
+    return failed ? EXIT_FAILURE : 0;
+}
+
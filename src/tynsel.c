@@ -0,0 +1,7 @@
+#include "tynsel.h"
+
+int tynsel_version(void)
+{
+    return TYNSEL_VERSION;
+}
+
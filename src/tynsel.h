@@ -0,0 +1,38 @@
+#ifndef TYNSEL_H_
+#define TYNSEL_H_
+
+// The public interface of libtynsel : an FSK modulator and demodulator for
+// Bell 103 style modems (see enum fsk_profile), for embedding. Decoders,
+// sessions, scanners and traces are opaque handles that the caller creates
+// and destroys. The settings and result structs, audio_state and
+// encode_state among them, are filled in by the caller, so their layout is
+// part of the ABI. The library keeps no state of its own, so objects used on
+// different threads never interact.
+//
+// The major version changes when a program built against one version could
+// misbehave with another, and is part of the shared library's soname. The
+// version is set per release, against the last release.
+
+#define TYNSEL_VERSION_MAJOR 1
+#define TYNSEL_VERSION_MINOR 0
+#define TYNSEL_VERSION_PATCH 0
+
+#define TYNSEL_VERSION \
+    (TYNSEL_VERSION_MAJOR * 10000 + TYNSEL_VERSION_MINOR * 100 + TYNSEL_VERSION_PATCH)
+
+#include "tynsel_api.h"
+#include "audio.h"
+#include "filters.h"
+#include "encode.h"
+#include "streamdecode.h"
+#include "livedecode.h"
+#include "burst.h"
+#include "session.h"
+#include "trace.h"
+
+// the TYNSEL_VERSION the library was built as, to compare against the one a
+// program was compiled with
+TYNSEL_API int tynsel_version(void);
+
+#endif
+
@@ -0,0 +1,13 @@
+#ifndef TYNSEL_API_H_
+#define TYNSEL_API_H_
+
+// Marks the functions and data that libtynsel exports. The library is built
+// with -fvisibility=hidden, so anything not marked stays internal to it.
+#if defined(__GNUC__)
+#define TYNSEL_API __attribute__((visibility("default")))
+#else
+#define TYNSEL_API
+#endif
+
+#endif
+